@@ -6,478 +6,5795 @@ Description: file accessing program for users to login, sort given spellbooks an
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <string_view>
+#include <charconv>
+#include <deque>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <csignal>
+#include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WIZARD_X86_KERNELS 1
+#endif
 
-struct spell {
-	std::string name;
-	float success_rate;
-	std::string effect;
+//a string stored in a catalog's string pool (see pool_view)
+struct pool_string {
+	std::uint64_t offset;
+	std::uint32_t length;
 };
 
+//a spellbook's own fields. its spells are the range [spell_begin, spell_end) of the catalog's spell columns
 struct spellbook {
-	std::string title;
-	std::string author;
+	pool_string title;
+	int author; // id interned in the catalog's authors
 	int num_pages;
 	int edition;
-	int num_spells;
+	int spell_begin;
+	int spell_end;
 	float avg_success_rate;
-	spell *spells;
+};
+
+//size in bytes of a SHA-256 digest
+const int SHA256_SIZE = 32;
+
+//size in bytes of the random salt of each password hash
+const int PASSWORD_SALT_SIZE = 16;
+
+//running state of a SHA-256 hash (see sha256_update)
+struct sha256_context {
+	std::uint32_t h[8];
+	std::uint8_t block[64]; // input not hashed yet
+	std::size_t block_len;
+	std::uint64_t total_len; // bytes hashed so far
+};
+
+//a salted PBKDF2-HMAC-SHA256 hash of a password
+struct password_hash {
+	int iterations; // 0 for a plain text password from the file, kept as an HMAC under the login index's key
+	std::uint8_t salt[PASSWORD_SALT_SIZE];
+	std::uint8_t hash[SHA256_SIZE];
 };
 
 //a struct to hold info of a wizard
 struct wizard {
 	std::string name;
 	int id; // Used for logging in
-	std::string password; // Used for logging in
+	std::string password; // plain text as read from the file, wiped once the wizards load (see load_credentials)
+	password_hash credential; // Used for logging in
 	std::string position_title; // Used to restrict poison and death spells
 	float beard_length;
 };
 
+//a spell line of the spellbook file as parsed by spell_schema, the text still in the input
+struct spell_record {
+	std::string_view name;
+	float success_rate;
+	std::string_view effect;
+};
+
+//the line starting a spellbook in the spellbook file (its spells follow it), see spellbook_schema
+struct spellbook_record {
+	std::string_view title;
+	std::string_view author;
+	int num_pages;
+	int edition;
+	int num_spells;
+};
+
+//a line of the wizard file, see wizard_schema
+struct wizard_record {
+	std::string_view name;
+	int id;
+	std::string_view password;
+	std::string_view position_title;
+	float beard_length;
+};
+
+//effects the menu knows about, interned first so their ids are fixed and can be compared as integers
+enum known_effect {
+	EFFECT_FIRE,
+	EFFECT_BUBBLE,
+	EFFECT_MEMORY_LOSS,
+	EFFECT_HEALING,
+	EFFECT_DEATH,
+	EFFECT_POISON,
+	NUM_KNOWN_EFFECTS
+};
+
+//interned strings (spell effects, authors), id -> string and string -> id
+struct intern_table {
+	std::deque<std::string> names; // a deque so the views used as keys below never move
+	std::unordered_map<std::string_view, int> ids;
+};
+
+//where one spell lives in the catalog
+struct effect_posting {
+	int book; // index of the spellbook holding the spell
+	int spell; // index of the spell in the spell columns
+};
+
+//every spellbook and spell, stored column by column inside one arena allocation so scans only touch the
+//columns they need. spell i is (names[i], success_rates[i], effect_ids[i])
+struct catalog {
+	const spellbook* spellbooks;
+	int num_spellbooks;
+	int num_spells;
+	const float* success_rates;
+	const int* effect_ids; // ids interned in effects
+	const pool_string* names;
+	const char* pool; // base of the string pool: the arena itself, or a mapped input file
+	char* arena; // the single allocation holding everything above (nullptr for a mapped snapshot)
+	intern_table effects;
+	intern_table authors;
+};
+
+//one bit per spell in catalog order, set when the spell may be shown to the logged-in wizard
+typedef std::vector<std::uint64_t> spell_mask;
+
+//a position_title whose wizards may not see spells with some of the known effects
+struct role {
+	const char* position_title;
+	int restricted[NUM_KNOWN_EFFECTS]; // known_effect ids hidden from the role
+	int num_restricted;
+};
+
+//every role with restrictions. wizards whose position_title isn't listed get the first, unrestricted, role
+const role ROLES[] = {
+	{"", {}, 0},
+	{"Student", {EFFECT_DEATH, EFFECT_POISON}, 2},
+};
+const int NUM_ROLES = sizeof(ROLES) / sizeof(ROLES[0]);
+
+//success_rate histogram buckets of the aggregates, bucket k counts rates in [10k, 10k + 10) (the last one
+//also takes 100 and above, the first anything below 0)
+const int NUM_RATE_BUCKETS = 10;
+
+//count, sum, min, max and histogram of the success rates of a group of spells
+struct rate_aggregate {
+	int count;
+	double sum;
+	float min;
+	float max;
+	int histogram[NUM_RATE_BUCKETS];
+};
+
+//the aggregates a role may see, grouped three ways
+struct aggregate_tables {
+	std::vector<rate_aggregate> by_effect; // by_effect[e] covers the spells with effect id e
+	std::vector<rate_aggregate> by_author; // by_author[a] covers the spells in author a's spellbooks
+	std::vector<int> editions; // every edition, ascending
+	std::vector<rate_aggregate> by_edition; // by_edition[i] covers the spells in spellbooks of editions[i]
+	std::unordered_map<int, int> edition_rows; // edition -> its index in editions
+};
+
+//what one role may see of a catalog version, built once when the version is published
+struct role_view {
+	spell_mask visible;
+	std::vector<int> spells; // indices of the visible spells, in catalog order
+	aggregate_tables aggregates; // over spells only
+};
+
+//result of the success rate kernels over a range of the success_rate column
+struct rate_stats {
+	double sum; // accumulated in double so averages match a plain double loop
+	float min;
+	float max;
+	int count;
+};
+
+//instruction sets the kernels can use, picked once at runtime by simd_level
+enum simd_support {
+	SIMD_SCALAR,
+	SIMD_SSE,
+	SIMD_AVX2
+};
+
+//formats output into one reusable block and hands it to a stream in big writes instead of a flush per line
+struct output_buffer {
+	std::ostream* out; // std::cout or an output file, nullptr when writing to fd
+	int fd; // client socket of the query server, -1 when writing to out
+	std::vector<char> data;
+	std::size_t bytes_written; // total handed to out/fd so far
+};
+
+//output_buffer writes its block out once it holds this many bytes
+const std::size_t OUTPUT_BLOCK_SIZE = 1 << 20;
+
+//sections of a catalog snapshot file, each one a raw copy of the matching catalog column or index
+enum snapshot_section {
+	SECTION_SPELLBOOKS,
+	SECTION_SUCCESS_RATES,
+	SECTION_EFFECT_IDS,
+	SECTION_NAMES,
+	SECTION_EFFECT_NAMES, // one pool_string per effect id
+	SECTION_AUTHOR_NAMES, // one pool_string per author id
+	SECTION_POOL,
+	SECTION_TITLE_ORDER, // title_index::sorted
+	SECTION_EFFECT_OFFSETS, // effect_index::offsets
+	SECTION_EFFECT_POSTINGS, // effect_index::postings
+	SECTION_EDITIONS, // aggregate_tables::editions, the same for every role
+	SECTION_AGGREGATES, // for each role in ROLES order, its by_effect, by_author and by_edition rows
+	NUM_SNAPSHOT_SECTIONS
+};
+
+//first bytes of a catalog snapshot, followed by the 64-byte aligned sections it lists
+struct snapshot_header {
+	char magic[8]; // SNAPSHOT_MAGIC
+	std::uint32_t version; // SNAPSHOT_VERSION
+	std::uint32_t byte_order; // 0x01020304 as written by the machine that made the snapshot
+	std::uint32_t spellbook_size; // sizeof(spellbook) when written, guards against layout changes
+	std::int32_t num_spellbooks;
+	std::int32_t num_spells;
+	std::int32_t num_effects;
+	std::int32_t num_authors;
+	std::int32_t num_editions;
+	std::int32_t num_roles; // NUM_ROLES when written
+	std::uint64_t section_offset[NUM_SNAPSHOT_SECTIONS];
+	std::uint64_t section_size[NUM_SNAPSHOT_SECTIONS];
+};
+
+const char SNAPSHOT_MAGIC[8] = {'W', 'I', 'Z', 'S', 'N', 'A', 'P', '\0'};
+const std::uint32_t SNAPSHOT_VERSION = 3;
+
+//growable columns a loader appends to, packed into a catalog arena by finish_catalog
+struct catalog_builder {
+	std::vector<spellbook> spellbooks;
+	std::vector<float> success_rates;
+	std::vector<int> effect_ids;
+	std::vector<pool_string> names;
+	std::string pool; // strings owned by the catalog, for loaders that can't point into their input
+	std::unordered_map<std::size_t, pool_string> pooled; // hash of a string in pool -> where it is, so repeats share it
+	intern_table effects;
+	intern_table authors;
+};
+
+//inverted index from effect id to the spells with that effect, in catalog order
+struct effect_index {
+	std::vector<int> offsets; // postings of effect e are [offsets[e], offsets[e + 1])
+	std::vector<effect_posting> postings;
+};
+
+//title lookup for 'search spellbook by its name', built once after read_in_data or read from a snapshot
+struct title_index {
+	std::vector<int> sorted; // spellbook indices ordered by title, equal titles in catalog order
+};
+
+//one slot of the login index
+struct login_slot {
+	int id;
+	int wizard; // index into the wizards array, -1 for an empty slot
+	bool duplicate; // id appears more than once in the wizards file
+};
+
+//token bucket limiting the login attempts on one id
+struct login_bucket {
+	double tokens;
+	std::chrono::steady_clock::time_point refilled;
+};
+
+//a password that recently logged a wizard in, kept as a keyed digest so repeat logins skip PBKDF2
+struct cached_login {
+	bool valid;
+	std::uint8_t digest[SHA256_SIZE]; // HMAC of the password under the guard's cache key
+	std::chrono::steady_clock::time_point verified;
+};
+
+//the parts of the login index that logins write, all guarded by lock
+struct login_guard {
+	std::mutex lock;
+	std::vector<login_bucket> buckets; // buckets[slot] limits a known id, buckets[capacity + hash] unknown ids
+	std::vector<cached_login> cache; // cache[w] is wizard w's last verified password, cache[num_wizards] the dummy's
+	password_hash dummy; // checked for unknown ids, as costly as the costliest real credential
+	sha256_context cache_inner; // HMAC keys of the cache, from a key drawn at random per run so a cached
+	sha256_context cache_outer; // digest means nothing outside the process
+};
+
+//open-addressing hash table from wizard id to wizard, built once after read_in_data
+struct login_index {
+	login_slot* slots;
+	int capacity; // always a power of two
+	login_guard* guard; // rate limiter and verification cache, the only part written after the index is built
+};
+
+//how login_verification answered
+enum login_result {
+	LOGIN_OK,
+	LOGIN_FAILED, // no wizard with that id and password
+	LOGIN_THROTTLED // too many recent attempts on the id, the password wasn't checked
+};
+
+//how run_session_command handled a query line
+enum command_result {
+	COMMAND_OK, // answered
+	COMMAND_FAILED, // answered with an error line
+	COMMAND_QUERY // a query the caller runs itself
+};
+
+//PBKDF2 iterations of the hashes written by --hash-wizards
+const int PASSWORD_ITERATIONS = 100000;
+
+//prefix of a hashed password in a wizard file: pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>
+const char PASSWORD_HASH_PREFIX[] = "pbkdf2-sha256$";
+
+//failed login attempts allowed on one id in a burst, and how fast the allowance comes back
+const double LOGIN_BURST = 5;
+const double LOGIN_REFILL_PER_SECOND = 0.2;
+
+//how long a verified password stays in the login cache
+const std::chrono::minutes LOGIN_CACHE_TTL(10);
+
+//a read-only memory mapping of a whole input file
+struct mapped_file {
+	const char* data;
+	std::size_t size;
+	bool owned; // data is a heap copy made by read_whole_file rather than a mapping
+};
+
+//position of the hand-written tokenizer inside a mapped file
+struct token_cursor {
+	const char* pos;
+	const char* end;
+};
+
+//a lightweight sort key so ranking moves 8 bytes per spell instead of whole spell records
+struct rank_key {
+	float success_rate;
+	int spell; // index of the spell in the catalog's spell columns
+};
+
+//one generation of the spellbooks and the indexes built over them, never changed once published (apart
+//from indexes built on first use, see rate_order). every query holds the version it started on, so a reload
+//can publish a new one without waiting for readers
+struct catalog_version {
+	catalog cat;
+	effect_index effects;
+	title_index titles;
+	mutable std::once_flag rate_order_built;
+	mutable std::vector<rank_key> by_rate; // every spell in rank_before order, for success_rate ranges and sorts
+	mapped_file spellbook_map; // string pool of cat when the spellbooks were mapped or copied
+	std::vector<const char*> record_starts; // where each spellbook's text record starts in spellbook_map, plus its end
+	std::vector<std::uint64_t> record_hashes; // hash of each record, empty when the version can't be reused by a reload
+	std::vector<role_view> views; // views[r] is what ROLES[r] may see
+};
+
+//everything loaded from the wizard and spellbook files, plus the indexes built over it
+struct library {
+	wizard* wizards;
+	int num_wizards;
+	login_index logins;
+	std::shared_ptr<const catalog_version> spellbooks; // only read and replaced with std::atomic_load/atomic_store
+	std::string spellbook_file;
+	bool watching; // spellbooks are reloaded when the file changes (see watch_spellbooks)
+};
+
+//lets main stop the spellbook watcher without waiting out its poll interval
+struct file_watch {
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping;
+};
+
+//effects of generated spells and how many in every 100 get each one, the known effects first
+const char* const GENERATED_EFFECTS[] = {"fire", "healing", "bubble", "memory_loss", "poison", "death",
+	"levitation", "invisibility", "summoning"};
+const int GENERATED_EFFECT_WEIGHTS[] = {30, 22, 15, 15, 8, 6, 2, 1, 1};
+
+//title words of generated spellbooks, so prefix searches have something to find
+const char* const GENERATED_TITLE_WORDS[] = {"Ancient", "Arcane", "Forbidden", "Lost", "Grand", "Wacky",
+	"Secret", "Dark"};
+
+//a window onto a spellbook file that streaming mode parses a batch of spellbooks at a time, so the whole
+//catalog never has to fit in memory
+struct spellbook_stream {
+	int fd;
+	std::vector<char> data; // STREAM_BLOCK_SIZE bytes, grown only for a single record bigger than that
+	std::size_t begin; // first byte of data not parsed yet
+	std::size_t end; // end of the bytes read into data
+	bool eof;
+	int books_left; // spellbooks the file declares that haven't been read yet
+	long long spells_seen; // spells in the batches already read, i.e. the file-wide index of the next spell
+};
+
+//bytes of the spellbook file streaming mode reads at a time
+const std::size_t STREAM_BLOCK_SIZE = 1 << 22;
+
+//a spell kept by streaming mode's top-k heap, copied out of its batch
+struct ranked_spell {
+	float success_rate;
+	long long spell; // file-wide index, breaks ties the way rank_before does
+	std::string name;
+	std::string effect;
+};
+
+//fields the query engine can filter and sort on, named in QUERY_FIELD_NAMES. the first five belong to the
+//spell's spellbook
+enum query_field {
+	FIELD_TITLE,
+	FIELD_AUTHOR,
+	FIELD_PAGES,
+	FIELD_EDITION,
+	FIELD_AVG_SUCCESS_RATE,
+	FIELD_NAME,
+	FIELD_SUCCESS_RATE,
+	FIELD_EFFECT,
+	NUM_QUERY_FIELDS
+};
+
+const char* const QUERY_FIELD_NAMES[NUM_QUERY_FIELDS] = {"title", "author", "pages", "edition",
+	"avg_success_rate", "name", "success_rate", "effect"};
+
+//comparisons a query predicate can make, written as QUERY_OP_NAMES
+enum query_op {
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	NUM_QUERY_OPS
+};
+
+const char* const QUERY_OP_NAMES[NUM_QUERY_OPS] = {"=", "!=", "<", "<=", ">", ">="};
+
+//one 'field op value' condition of a query
+struct query_predicate {
+	query_field field;
+	query_op op;
+	double number; // value of a numeric field
+	std::string text; // value of a text field
+	int id; // interned id of text for author and effect, -1 if no spellbook or spell has it
+};
+
+//one key of a query's sort order
+struct query_sort_key {
+	query_field field;
+	bool descending;
+};
+
+//a parsed 'find' query: spells matching every predicate of at least one group, in sort order
+struct spell_query {
+	std::vector<std::vector<query_predicate>> groups; // OR of groups, each an AND of predicates
+	std::vector<query_sort_key> sort; // catalog order when empty (and for ties)
+	int limit; // 0 for no limit
+};
+
+//how the planner reads the candidates of one group of a query
+enum query_access {
+	ACCESS_BOOK_SCAN, // every spellbook, rejecting whole books on their own fields first
+	ACCESS_EFFECT_INDEX, // the postings of one effect
+	ACCESS_RATE_INDEX, // a success_rate range of by_rate
+	ACCESS_TITLE_INDEX // the spellbooks with one title
+};
+
+//the planner's choice for one group of a query
+struct query_plan {
+	query_access access;
+	int first; // postings or by_rate range to read, [first, last)
+	int last;
+	std::vector<int> books; // spellbooks to read for ACCESS_TITLE_INDEX
+	long long estimate; // spells the access path will visit
+};
+
+//how often the spellbook watcher checks the file for changes
+const std::chrono::milliseconds WATCH_INTERVAL(1000);
+
+//operations timed by the instrumentation (see scoped_timer), named in STAT_NAMES
+enum stat_id {
+	STAT_LOAD,
+	STAT_RELOAD,
+	STAT_LOGIN,
+	STAT_DISPLAY_ALL,
+	STAT_TITLE_SEARCH,
+	STAT_EFFECT_SEARCH,
+	STAT_RANKING,
+	STAT_FIND,
+	STAT_EXPORT,
+	NUM_STATS
+};
+
+const char* const STAT_NAMES[NUM_STATS] = {"load", "reload", "login", "display_all", "title_search",
+	"effect_search", "ranking", "find", "export"};
+
+//events counted by the instrumentation, named in COUNTER_NAMES
+enum counter_id {
+	COUNTER_FAILED_LOGINS,
+	COUNTER_THROTTLED_LOGINS,
+	COUNTER_FAILED_QUERIES,
+	COUNTER_CONNECTIONS,
+	NUM_COUNTERS
+};
+
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {"failed_logins", "throttled_logins", "failed_queries", "connections"};
+
+//latency histogram buckets, bucket k counts operations that took [2^k, 2^(k+1)) nanoseconds
+const int NUM_LATENCY_BUCKETS = 48;
+
+//running totals of one timed operation, updated with relaxed atomics so any thread can record
+struct op_stats {
+	std::atomic<std::uint64_t> count;
+	std::atomic<std::uint64_t> total_ns;
+	std::atomic<std::uint64_t> max_ns;
+	std::atomic<std::uint64_t> bytes; // output the operations wrote
+	std::atomic<std::uint64_t> buckets[NUM_LATENCY_BUCKETS];
+};
+
+//everything the instrumentation has recorded. only touched when stats_enabled is set
+op_stats op_totals[NUM_STATS];
+std::atomic<std::uint64_t> counters[NUM_COUNTERS];
+
+//set once by main (--stats) before any other thread starts, off by default so the hot paths only pay a branch
+bool stats_enabled = false;
+
+//times one operation into op_totals from construction until it goes out of scope. when stats are off it
+//doesn't even read the clock
+struct scoped_timer {
+	stat_id id;
+	std::chrono::steady_clock::time_point start;
+	std::size_t bytes; // set by the operation to the output it wrote
+
+	explicit scoped_timer(stat_id op) : id(op), bytes(0) {
+		if (stats_enabled)
+			start = std::chrono::steady_clock::now();
+	}
+	~scoped_timer();
+};
+
+//longest request line the query server accepts before dropping the client
+const std::size_t MAX_REQUEST_LINE = 1 << 16;
+
+//how long the query server waits on a client that stops reading its answers before giving up on it
+const int CLIENT_SEND_TIMEOUT_SECONDS = 5;
+
+//set by the SIGINT/SIGTERM handler to shut the query server down
+volatile std::sig_atomic_t server_stopping = 0;
+
+//what one logged-in wizard may see, worked out once at login
+struct session {
+	const wizard* user; // nullptr until someone logs in
+	int role; // index into ROLES
+	std::shared_ptr<const catalog_version> version; // spellbooks the session's queries currently run on
+	const role_view* view; // the role's view of version
+};
+
+//one client of the query server. the accept loop reads its request lines, and at most one worker at a
+//time answers them, so the session needs no lock of its own
+struct client_connection {
+	int fd;
+	session s;
+	std::string pending; // start of a request line still being received, only touched by the accept loop
+	std::deque<std::string> lines; // complete request lines no worker has answered yet
+	bool busy; // queued for or being answered by a worker
+	bool closed; // the client hung up (or was dropped), close fd once its lines are answered
+};
+
+//clients with request lines waiting for a worker
+struct request_queue {
+	std::mutex lock; // also guards the lines, busy and closed of every client
+	std::condition_variable ready;
+	std::deque<std::shared_ptr<client_connection>> clients; // nullptr tells a worker to exit
+};
+
+//a place in 'display all' for paging through the spellbooks, only the page asked for is formatted
+struct display_cursor {
+	int next; // next spellbook to write, in catalog order
+	int page_size; // spellbooks per page, 0 for all the rest
+};
+
+//spellbooks per page of a file export, the file is written out after each page
+const int EXPORT_PAGE_SIZE = 4096;
+
+//most files a 'shard <prefix> <n>' export may be split into
+const int MAX_EXPORT_SHARDS = 1024;
+
+//what export_shards splits the catalog by
+enum shard_key {
+	SHARD_BY_EFFECT,
+	SHARD_BY_AUTHOR,
+	SHARD_BY_HASH
+};
+
+//one file of a sharded export: the spells of one effect, or a list of spellbooks
+struct shard_task {
+	std::string filename;
+	int effect; // effect whose spells go in the file, -1 for the spellbooks in books
+	std::vector<int> books;
+};
+
+//key counts below this are sorted on the calling thread, spawning threads costs more than it saves
+const int PARALLEL_SORT_THRESHOLD = 1 << 16;
+
+//mapped spellbook files smaller than this (in bytes) are parsed on the calling thread
+const std::size_t PARALLEL_PARSE_THRESHOLD = 1 << 22;
+
+/*
+Function: create_effect_table
+Description: makes an intern table for effects with the effects the menu knows about already interned,
+	in the order of known_effect
+Returns: the new effect table
+*/
+intern_table create_effect_table() {
+	intern_table table;
+	const char* known[NUM_KNOWN_EFFECTS] = {"fire", "bubble", "memory_loss", "healing", "death", "poison"};
+	for (int i = 0; i < NUM_KNOWN_EFFECTS; i++) {
+		table.names.push_back(known[i]);
+		table.ids[table.names.back()] = i;
+	}
+	return table;
+}
+
+/*
+Function: intern_string
+Description: returns the id of a string (an effect or an author), adding it to the table if it hasn't
+	been seen yet
+Parameters: intern_table &table: the intern table
+			std::string_view str: the string
+Returns: the string's id
+*/
+int intern_string(intern_table &table, std::string_view str) {
+	std::unordered_map<std::string_view, int>::const_iterator it = table.ids.find(str);
+	if (it != table.ids.end())
+		return it->second;
+
+	int id = table.names.size();
+	table.names.push_back(std::string(str));
+	table.ids[table.names.back()] = id;
+	return id;
+}
+
+/*
+Function: find_string
+Description: looks a string up without interning it
+Parameters: const intern_table &table: the intern table
+			std::string_view str: the string, e.g. an effect name
+Returns: the string's id, or -1 if it isn't in the table (for effects: no spell has it and the menu
+	doesn't know it)
+*/
+int find_string(const intern_table &table, std::string_view str) {
+	std::unordered_map<std::string_view, int>::const_iterator it = table.ids.find(str);
+	return it == table.ids.end() ? -1 : it->second;
+}
+
+/*
+ * Function: simd_level
+ * Description: Checks once which vector instruction sets this CPU has, so a
+ * 		binary built for plain x86-64 still uses AVX2 where it is available.
+ * Returns: The best instruction set the kernels can use
+ */
+simd_support simd_level() {
+#ifdef WIZARD_X86_KERNELS
+	static const simd_support level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 :
+									__builtin_cpu_supports("sse2") ? SIMD_SSE : SIMD_SCALAR;
+	return level;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
 /*
- * Function: create_spells
- * Description: Allocates a dynamic array of spells of the requested size and
- * 		returns a pointer that points to it
+ * Function: rate_stats_scalar
+ * Description: Plain loop version of rate_stats_kernel, also used for the
+ * 		tails the vector versions leave over.
  * Parameters:
- * 		size (int): Size of dynamic array of spells to create
- * Returns: Pointer that points to dynamically allocated array of spells
+ * 		rates (const float*): First success rate of the range
+ * 		n (int): Number of success rates in the range
+ * 		stats (rate_stats&): Accumulated into
  */
-spell* create_spells(int size) {
-	
-	spell* spell_array = new spell[size];
-	return spell_array;
+void rate_stats_scalar(const float* rates, int n, rate_stats &stats) {
+	for (int i = 0; i < n; i++) {
+		stats.sum += rates[i];
+		stats.min = std::min(stats.min, rates[i]);
+		stats.max = std::max(stats.max, rates[i]);
+	}
 }
 
+#ifdef WIZARD_X86_KERNELS
 /*
- * Function: read_spell_data
- * Description: Reads all of the information associated with a single spell
- * 		structure from the given spellbooks text file and returns a created
- * 		spell structure containing that information.
+ * Function: rate_stats_sse
+ * Description: SSE version of rate_stats_kernel, 4 spells per step.
+ * Parameters: see rate_stats_scalar
+ */
+void rate_stats_sse(const float* rates, int n, rate_stats &stats) {
+	__m128d sum_lo = _mm_setzero_pd();
+	__m128d sum_hi = _mm_setzero_pd();
+	__m128 lo = _mm_set1_ps(stats.min);
+	__m128 hi = _mm_set1_ps(stats.max);
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_loadu_ps(rates + i);
+		sum_lo = _mm_add_pd(sum_lo, _mm_cvtps_pd(v));
+		sum_hi = _mm_add_pd(sum_hi, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		lo = _mm_min_ps(lo, v);
+		hi = _mm_max_ps(hi, v);
+	}
+
+	double sums[2];
+	float mins[4], maxs[4];
+	_mm_storeu_pd(sums, _mm_add_pd(sum_lo, sum_hi));
+	_mm_storeu_ps(mins, lo);
+	_mm_storeu_ps(maxs, hi);
+	stats.sum += sums[0] + sums[1];
+	for (int k = 0; k < 4; k++) {
+		stats.min = std::min(stats.min, mins[k]);
+		stats.max = std::max(stats.max, maxs[k]);
+	}
+	rate_stats_scalar(rates + i, n - i, stats);
+}
+
+/*
+ * Function: rate_stats_avx2
+ * Description: AVX2 version of rate_stats_kernel, 8 spells per step.
+ * Parameters: see rate_stats_scalar
+ */
+__attribute__((target("avx2")))
+void rate_stats_avx2(const float* rates, int n, rate_stats &stats) {
+	__m256d sum_lo = _mm256_setzero_pd();
+	__m256d sum_hi = _mm256_setzero_pd();
+	__m256 lo = _mm256_set1_ps(stats.min);
+	__m256 hi = _mm256_set1_ps(stats.max);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(rates + i);
+		sum_lo = _mm256_add_pd(sum_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+		sum_hi = _mm256_add_pd(sum_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+		lo = _mm256_min_ps(lo, v);
+		hi = _mm256_max_ps(hi, v);
+	}
+
+	double sums[4];
+	float mins[8], maxs[8];
+	_mm256_storeu_pd(sums, _mm256_add_pd(sum_lo, sum_hi));
+	_mm256_storeu_ps(mins, lo);
+	_mm256_storeu_ps(maxs, hi);
+	stats.sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	for (int k = 0; k < 8; k++) {
+		stats.min = std::min(stats.min, mins[k]);
+		stats.max = std::max(stats.max, maxs[k]);
+	}
+	rate_stats_scalar(rates + i, n - i, stats);
+}
+#endif
+
+/*
+ * Function: rate_stats_kernel
+ * Description: Computes the sum, min and max of a range of the success_rate
+ * 		column with the widest kernel this CPU supports. The mean is
+ * 		sum / count.
  * Parameters:
- * 		file (std::ifstream&): A reference to an std::ifstream that is open on
- * 		the input spellbooks text file and prepared to read information about
- * 		the next spell in a spellbook.
- * Returns: The created spell structure containing the information of the
- * 		next spell in the input file
+ * 		rates (const float*): First success rate of the range
+ * 		n (int): Number of success rates in the range
+ * Returns: The statistics of the range (min/max are +/-infinity when empty)
  */
-spell read_spell_data(std::ifstream& file) {
-	spell s;
-	file >> s.name >> s.success_rate >> s.effect;
-	return s;
+rate_stats rate_stats_kernel(const float* rates, int n) {
+	rate_stats stats = {0, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), n};
+#ifdef WIZARD_X86_KERNELS
+	if (simd_level() == SIMD_AVX2) {
+		rate_stats_avx2(rates, n, stats);
+		return stats;
+	}
+	if (simd_level() == SIMD_SSE) {
+		rate_stats_sse(rates, n, stats);
+		return stats;
+	}
+#endif
+	rate_stats_scalar(rates, n, stats);
+	return stats;
 }
 
 /*
- * Function: create_spellbooks
- * Description: Allocates a dynamic array of spellbooks of the requested size
- * 		and returns a pointer that points to it.
+ * Function: visibility_scalar
+ * Description: Plain loop version of visibility_kernel for spells [first, n).
+ * Parameters: see visibility_kernel, plus
+ * 		first (int): First spell to look at
+ */
+void visibility_scalar(const int* effect_ids, int first, int n, const int* restricted, int num_restricted,
+						std::uint64_t* mask) {
+	for (int i = first; i < n; i++) {
+		bool hidden = false;
+		for (int r = 0; r < num_restricted; r++)
+			hidden = hidden || effect_ids[i] == restricted[r];
+		if (not hidden)
+			mask[i / 64] |= (std::uint64_t)1 << (i % 64);
+	}
+}
+
+#ifdef WIZARD_X86_KERNELS
+/*
+ * Function: visibility_sse
+ * Description: SSE version of visibility_kernel, 4 spells per step.
+ * Parameters: see visibility_kernel
+ */
+void visibility_sse(const int* effect_ids, int n, const int* restricted, int num_restricted, std::uint64_t* mask) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(effect_ids + i));
+		__m128i hidden = _mm_setzero_si128();
+		for (int r = 0; r < num_restricted; r++)
+			hidden = _mm_or_si128(hidden, _mm_cmpeq_epi32(v, _mm_set1_epi32(restricted[r])));
+		std::uint64_t bits = ~_mm_movemask_ps(_mm_castsi128_ps(hidden)) & 0xF;
+		mask[i / 64] |= bits << (i % 64);
+	}
+	visibility_scalar(effect_ids, i, n, restricted, num_restricted, mask);
+}
+
+/*
+ * Function: visibility_avx2
+ * Description: AVX2 version of visibility_kernel, 8 spells per step.
+ * Parameters: see visibility_kernel
+ */
+__attribute__((target("avx2")))
+void visibility_avx2(const int* effect_ids, int n, const int* restricted, int num_restricted, std::uint64_t* mask) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(effect_ids + i));
+		__m256i hidden = _mm256_setzero_si256();
+		for (int r = 0; r < num_restricted; r++)
+			hidden = _mm256_or_si256(hidden, _mm256_cmpeq_epi32(v, _mm256_set1_epi32(restricted[r])));
+		std::uint64_t bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(hidden)) & 0xFF;
+		mask[i / 64] |= bits << (i % 64);
+	}
+	visibility_scalar(effect_ids, i, n, restricted, num_restricted, mask);
+}
+#endif
+
+/*
+ * Function: visibility_kernel
+ * Description: Builds the visibility bitmask of a range of the effect id
+ * 		column: bit i is set unless spell i has one of the restricted
+ * 		effects. Uses the widest kernel this CPU supports.
+ * Parameters:
+ * 		effect_ids (const int*): The effect id column
+ * 		n (int): Number of spells
+ * 		restricted (const int*): Effect ids to hide
+ * 		num_restricted (int): Number of effect ids to hide
+ * 		mask (std::uint64_t*): (n + 63) / 64 zeroed words to set bits in
+ */
+void visibility_kernel(const int* effect_ids, int n, const int* restricted, int num_restricted, std::uint64_t* mask) {
+#ifdef WIZARD_X86_KERNELS
+	if (simd_level() == SIMD_AVX2) {
+		visibility_avx2(effect_ids, n, restricted, num_restricted, mask);
+		return;
+	}
+	if (simd_level() == SIMD_SSE) {
+		visibility_sse(effect_ids, n, restricted, num_restricted, mask);
+		return;
+	}
+#endif
+	visibility_scalar(effect_ids, 0, n, restricted, num_restricted, mask);
+}
+
+/*
+ * Function: pool_view
+ * Description: Returns the characters of a pool_string.
+ * Parameters:
+ * 		cat (const catalog&): The catalog whose string pool holds the string
+ * 		s (pool_string): The string to look at
+ * Returns: A view of the string inside the catalog's pool
+ */
+std::string_view pool_view(const catalog &cat, pool_string s) {
+	return std::string_view(cat.pool + s.offset, s.length);
+}
+
+/*
+ * Function: add_pool_string
+ * Description: Copies a string onto the end of a builder's owned string pool,
+ * 		unless the pool already holds it, so repeated spell names share one copy.
+ * Parameters:
+ * 		b (catalog_builder&): The builder to add the string to
+ * 		str (std::string_view): The characters to store
+ * Returns: The pool_string referring to the stored copy
+ */
+pool_string add_pool_string(catalog_builder &b, std::string_view str) {
+	std::size_t hash = std::hash<std::string_view>()(str);
+	std::unordered_map<std::size_t, pool_string>::const_iterator it = b.pooled.find(hash);
+	if (it != b.pooled.end() && it->second.length == str.size() &&
+			b.pool.compare(it->second.offset, str.size(), str) == 0)
+		return it->second;
+
+	pool_string ps = {b.pool.size(), (std::uint32_t)str.size()};
+	b.pool.append(str);
+	b.pooled.emplace(hash, ps); // keeps the first string on a hash collision, the other is just stored twice
+	return ps;
+}
+
+/*
+Function: parse_field
+Description: converts one token of a record to a text field, which only has to be non-empty
+Parameters: std::string_view token: the token
+			std::string_view &value: set to the token
+Returns: a boolean value, true if the token was there
+*/
+bool parse_field(std::string_view token, std::string_view &value) {
+	value = token;
+	return not token.empty();
+}
+
+/*
+Function: parse_field
+Description: converts one token of a record to a numeric field with std::from_chars (no locale, no copy)
+Parameters: std::string_view token: the token
+			number &value: set to the parsed int or float
+Returns: a boolean value, true if the whole token was a number of that type
+*/
+template <typename number>
+bool parse_field(std::string_view token, number &value) {
+	std::from_chars_result r = std::from_chars(token.data(), token.data() + token.size(), value);
+	return not token.empty() && r.ec == std::errc() && r.ptr == token.data() + token.size();
+}
+
+//the whitespace separated fields of a text record in file order, given as pointers to the members of the
+//record struct they are parsed into. which conversion each field gets is picked at compile time from the
+//member's type, so parsing a record is one straight run of conversions with no per-field switching, and
+//format_record writes a record back out the same way
+template <auto... fields>
+struct record_schema {
+	static constexpr int size = sizeof...(fields);
+
+	//parses tokens[0, size) into r, stopping at the first field that doesn't convert
+	template <typename record>
+	static bool parse(const std::string_view* tokens, record &r) {
+		int i = 0;
+		return (parse_field(tokens[i++], r.*fields) && ...);
+	}
+};
+
+typedef record_schema<&spell_record::name, &spell_record::success_rate, &spell_record::effect> spell_schema;
+typedef record_schema<&spellbook_record::title, &spellbook_record::author, &spellbook_record::num_pages,
+	&spellbook_record::edition, &spellbook_record::num_spells> spellbook_schema;
+typedef record_schema<&wizard_record::name, &wizard_record::id, &wizard_record::password,
+	&wizard_record::position_title, &wizard_record::beard_length> wizard_schema;
+
+/*
+Function: read_record
+Description: reads one record from a stream with >> and parses it with its schema
+Parameters: std::istream &in: the open input file
+			std::string* tokens: schema::size strings to hold the tokens, r's text fields point into them
+			record &r: filled with the record
+Returns: a boolean value, true if a complete record was read
+*/
+template <typename schema, typename record>
+bool read_record(std::istream &in, std::string* tokens, record &r) {
+	std::string_view views[schema::size];
+	for (int i = 0; i < schema::size; i++) {
+		in >> tokens[i];
+		views[i] = tokens[i];
+	}
+	return schema::parse(views, r);
+}
+
+/*
+Function: add_spell
+Description: appends a parsed spell to the builder's spell columns, interning its effect
+Parameters: catalog_builder &b: the builder
+			const spell_record &r: the parsed spell
+			pool_string name: where the spell's name is in the catalog's string pool
+*/
+void add_spell(catalog_builder &b, const spell_record &r, pool_string name) {
+	b.names.push_back(name);
+	b.success_rates.push_back(r.success_rate);
+	b.effect_ids.push_back(intern_string(b.effects, r.effect));
+}
+
+/*
+ * Function: read_spell_data
+ * Description: Reads all of the information associated with a single spell
+ * 		from the given spellbooks text file and appends it to the builder's
+ * 		spell columns, interning its effect.
  * Parameters:
- * 		size (int): Size of dynamic array of spellbooks to create
- * Returns: Pointer that points to dynamically allocated array of spellbooks
+ * 		file (std::ifstream&): A reference to an std::ifstream that is open on
+ * 		the input spellbooks text file and prepared to read information about
+ * 		the next spell in a spellbook.
+ * 		b (catalog_builder&): The builder the spell is appended to
  */
-spellbook* create_spellbooks(int size) {
-	return new spellbook[size];
+void read_spell_data(std::ifstream& file, catalog_builder &b) {
+	std::string tokens[spell_schema::size];
+	spell_record r = {};
+	read_record<spell_schema>(file, tokens, r);
+	add_spell(b, r, add_pool_string(b, r.name));
 }
 
 /*
  * Function: read_spellbook_data
  * Description: Reads all of the information associated with a single spellbook
- * 		structure from the given spellbooks text file and returns a created
- * 		spellbook structure containing that information. Note that the
- * 		avg_success_rate member variable of the returned spellbook structure is
- * 		not contained in the text file, but rather will need to be computed as
- * 		the average (mean) success rate of all spells in the spellbook (i.e.,
- * 		add up the success rates of all spells in the spellbook, then divide by
- * 		the number of spells in the spellbook).
+ * 		from the given spellbooks text file, appending the spellbook and all of
+ * 		its spells to the builder. Note that the avg_success_rate member
+ * 		variable of the spellbook is not contained in the text file, it is
+ * 		computed by finish_catalog once all spells are in their column.
  * Parameters:
  * 		file (std::ifstream&): A reference to an std::ifstream that is open on
  * 		the input spellbooks text file and prepared to read information about
  * 		the next spellbook.
- * Returns: The created spellbook structure containing the information of the
- * 		next spellbook in the file
+ * 		b (catalog_builder&): The builder the spellbook is appended to
  */
-spellbook read_spellbook_data(std::ifstream& file) {
+void read_spellbook_data(std::ifstream& file, catalog_builder &b) {
+	std::string tokens[spellbook_schema::size];
+	spellbook_record r = {};
+	read_record<spellbook_schema>(file, tokens, r);
 	spellbook sb;
-	file >> sb.title >> sb.author >> sb.num_pages >> sb.edition >> sb.num_spells;
-	
-	sb.spells = create_spells(sb.num_spells);
+	sb.title = add_pool_string(b, r.title);
+	sb.author = intern_string(b.authors, r.author);
+	sb.num_pages = r.num_pages;
+	sb.edition = r.edition;
 	
-	for (int i = 0; i < sb.num_spells; i++)
-		sb.spells[i] = read_spell_data(file);
+	sb.spell_begin = b.names.size();
+	for (int i = 0; i < r.num_spells; i++)
+		read_spell_data(file, b);
+	sb.spell_end = b.names.size();
+
+	sb.avg_success_rate = 0;
+	b.spellbooks.push_back(sb);
+}
+
+/*
+ * Function: arena_column
+ * Description: Carves the next 64-byte aligned array out of an arena, so
+ * 		every column starts on its own cache line.
+ * Parameters:
+ * 		cursor (std::size_t&): Offset of the first free byte in the arena,
+ * 			moved past the array
+ * 		bytes (std::size_t): Size of the array
+ * Returns: Offset of the array inside the arena
+ */
+std::size_t arena_column(std::size_t &cursor, std::size_t bytes) {
+	std::size_t start = (cursor + 63) & ~(std::size_t)63;
+	cursor = start + bytes;
+	return start;
+}
+
+/*
+ * Function: finish_catalog
+ * Description: Packs everything the loader appended to one or more builders
+ * 		into a single arena allocation, points the catalog's columns at it
+ * 		and computes every spellbook's avg_success_rate. Several builders are
+ * 		concatenated in order, as if one builder had read them all: their
+ * 		spell ranges and owned pool offsets are shifted and their effect ids
+ * 		are re-interned into the first builder's table. Parts are copied by
+ * 		one thread per core, each claiming the next part as it finishes one.
+ * Parameters:
+ * 		parts (std::vector<catalog_builder>&): The filled builders, in file
+ * 			order. The first one's effects are moved into the catalog
+ * 		external_pool (const char*): Base of the string pool the builders'
+ * 			pool_strings refer to when they point into the loader's input (a
+ * 			mapped file), or nullptr to use (and copy) the builders' own pools
+ * 		cat (catalog&): The catalog to fill, release it with release_catalog
+ */
+void finish_catalog(std::vector<catalog_builder> &parts, const char* external_pool, catalog &cat) {
+	//where each part starts in the merged columns, and how its effect ids map onto the first part's
+	int num_parts = parts.size();
+	std::vector<int> book_start(num_parts + 1, 0), spell_start(num_parts + 1, 0);
+	std::vector<std::uint64_t> pool_start(num_parts + 1, 0);
+	std::vector<std::vector<int>> effect_map(num_parts), author_map(num_parts);
+	for (int k = 0; k < num_parts; k++) {
+		book_start[k + 1] = book_start[k] + parts[k].spellbooks.size();
+		spell_start[k + 1] = spell_start[k] + parts[k].names.size();
+		pool_start[k + 1] = pool_start[k] + parts[k].pool.size();
+		for (int e = 0; k > 0 && e < (int)parts[k].effects.names.size(); e++)
+			effect_map[k].push_back(intern_string(parts[0].effects, parts[k].effects.names[e]));
+		for (int a = 0; k > 0 && a < (int)parts[k].authors.names.size(); a++)
+			author_map[k].push_back(intern_string(parts[0].authors, parts[k].authors.names[a]));
+	}
+	cat.num_spellbooks = book_start[num_parts];
+	cat.num_spells = spell_start[num_parts];
+
+	//lay the columns out first, then allocate once
+	std::size_t cursor = 0;
+	std::size_t books_at = arena_column(cursor, cat.num_spellbooks * sizeof(spellbook));
+	std::size_t rates_at = arena_column(cursor, cat.num_spells * sizeof(float));
+	std::size_t effects_at = arena_column(cursor, cat.num_spells * sizeof(int));
+	std::size_t names_at = arena_column(cursor, cat.num_spells * sizeof(pool_string));
+	std::size_t pool_at = arena_column(cursor, external_pool == nullptr ? pool_start[num_parts] : 0);
+
+	cat.arena = new char[cursor + 64];
+	char* base = cat.arena + ((64 - (std::uintptr_t)cat.arena % 64) % 64);
+	spellbook* spellbooks = reinterpret_cast<spellbook*>(base + books_at);
+	float* success_rates = reinterpret_cast<float*>(base + rates_at);
+	int* effect_ids = reinterpret_cast<int*>(base + effects_at);
+	pool_string* names = reinterpret_cast<pool_string*>(base + names_at);
+	cat.spellbooks = spellbooks;
+	cat.success_rates = success_rates;
+	cat.effect_ids = effect_ids;
+	cat.names = names;
+	cat.pool = external_pool == nullptr ? base + pool_at : external_pool;
+
+	auto copy_part = [&](int k) {
+		catalog_builder &b = parts[k];
+		std::uint64_t pool_shift = external_pool == nullptr ? pool_start[k] : 0;
+		for (std::size_t i = 0; i < b.spellbooks.size(); i++) {
+			spellbook sb = b.spellbooks[i];
+			sb.title.offset += pool_shift;
+			sb.author = k == 0 ? sb.author : author_map[k][sb.author];
+			sb.spell_begin += spell_start[k];
+			sb.spell_end += spell_start[k];
+			spellbooks[book_start[k] + i] = sb;
+		}
+		std::copy(b.success_rates.begin(), b.success_rates.end(), success_rates + spell_start[k]);
+		for (std::size_t i = 0; i < b.names.size(); i++) {
+			effect_ids[spell_start[k] + i] = k == 0 ? b.effect_ids[i] : effect_map[k][b.effect_ids[i]];
+			names[spell_start[k] + i] = {b.names[i].offset + pool_shift, b.names[i].length};
+		}
+		if (external_pool == nullptr)
+			std::copy(b.pool.begin(), b.pool.end(), base + pool_at + pool_start[k]);
+
+		//average success rate of each spellbook, straight off the contiguous column
+		for (int i = book_start[k]; i < book_start[k + 1]; i++) {
+			spellbook &sb = spellbooks[i];
+			rate_stats stats = rate_stats_kernel(success_rates + sb.spell_begin, sb.spell_end - sb.spell_begin);
+			sb.avg_success_rate = stats.sum/stats.count;
+		}
+	};
+	std::atomic<int> next_part(0);
+	auto copier = [&]() {
+		for (int k = next_part++; k < num_parts; k = next_part++)
+			copy_part(k);
+	};
+	int num_threads = std::max(1, std::min<int>(std::thread::hardware_concurrency(), num_parts));
+	std::vector<std::thread> copiers;
+	for (int t = 1; t < num_threads; t++)
+		copiers.emplace_back(copier);
+	copier();
+	for (std::thread &t : copiers) t.join();
+	cat.effects = std::move(parts[0].effects);
+	cat.authors = std::move(parts[0].authors);
+}
+
+/*
+ * Function: release_catalog
+ * Description: Deletes all of the dynamic memory of a catalog (a single
+ * 		arena) and resets its columns to nullptr.
+ * Parameters:
+ * 		cat (catalog&): The catalog to release
+ */
+void release_catalog(catalog &cat) {
+	delete[] cat.arena;
+	cat.arena = nullptr;
+	cat.spellbooks = nullptr;
+	cat.success_rates = nullptr;
+	cat.effect_ids = nullptr;
+	cat.names = nullptr;
+	cat.pool = nullptr;
+	cat.num_spellbooks = 0;
+	cat.num_spells = 0;
+}
+
+/*
+Function: create_wizards
+Description: allocates a dynamic array of wizardss of the requested size
+ * 		and returns a pointer that points to it.
+Parameters: size (int): Size of dynamic array of wizards to create
+Returns: Pointer that points to dynamically allocated array of wizards
+*/
+wizard* create_wizards(int size) {
+	return new wizard[size];
+}
+
+/*
+Function: make_wizard
+Description: copies a parsed wizard record into a wizard
+Parameters: const wizard_record &r: the parsed record
+Returns: the wizard, its password still in plain text until load_credentials runs
+*/
+wizard make_wizard(const wizard_record &r) {
+	wizard w;
+	w.name = r.name;
+	w.id = r.id;
+	w.password = r.password;
+	w.position_title = r.position_title;
+	w.beard_length = r.beard_length;
+	return w;
+}
+
+/*
+Function: read_wizard_data
+Description: reads in wizard data from the user-given file and creates a wizards
+ * 		data structure with each line 
+Parameters: user given file
+Returns: the newly-made wizard object 
+*/
+wizard read_wizard_data(std::ifstream &file) {
+	std::string tokens[wizard_schema::size];
+	wizard_record r = {};
+	read_record<wizard_schema>(file, tokens, r);
+	return make_wizard(r);
+}
+
+/*
+Function: delete_wizards
+Description: deletes all of the dynamic memory associated with the given
+ * 		array of wizards. The size parameter indicates the size of the array of
+ * 		wizards.
+Parameters: wizard (wizards*&): A reference to the pointer that points to the dynamic
+ * 			array of wizards to be deleted.
+*/
+void delete_wizards(wizard*& wizards) {
+	delete[] wizards;
+	wizards = nullptr;
+}
+
+/*
+Function: sha256_init
+Description: starts a SHA-256 hash
+Parameters: sha256_context &ctx: the context to reset
+*/
+void sha256_init(sha256_context &ctx) {
+	const std::uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+		0x1f83d9ab, 0x5be0cd19};
+	std::memcpy(ctx.h, initial, sizeof(initial));
+	ctx.block_len = 0;
+	ctx.total_len = 0;
+}
+
+/*
+Function: sha256_compress
+Description: the SHA-256 compression function, folds one 64 byte block into the hash state
+Parameters: std::uint32_t h[8]: the hash state
+			const std::uint8_t* block: 64 bytes of input
+*/
+void sha256_compress(std::uint32_t h[8], const std::uint8_t* block) {
+	static const std::uint32_t K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+	auto rotr = [](std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+	std::uint32_t w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (std::uint32_t)block[4 * i] << 24 | (std::uint32_t)block[4 * i + 1] << 16 |
+			(std::uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+	for (int i = 0; i < 64; i++) {
+		std::uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+/*
+Function: sha256_update
+Description: adds input to a SHA-256 hash, compressing every full block
+Parameters: sha256_context &ctx: the running hash
+			const void* data: the input
+			std::size_t len: number of bytes of input
+*/
+void sha256_update(sha256_context &ctx, const void* data, std::size_t len) {
+	const std::uint8_t* in = (const std::uint8_t*)data;
+	ctx.total_len += len;
+	while (len > 0) {
+		std::size_t take = std::min(len, sizeof(ctx.block) - ctx.block_len);
+		std::memcpy(ctx.block + ctx.block_len, in, take);
+		ctx.block_len += take;
+		in += take;
+		len -= take;
+		if (ctx.block_len == sizeof(ctx.block)) {
+			sha256_compress(ctx.h, ctx.block);
+			ctx.block_len = 0;
+		}
+	}
+}
+
+/*
+Function: sha256_final
+Description: pads the input and writes the digest
+Parameters: sha256_context &ctx: the running hash, unusable afterwards
+			std::uint8_t* digest: SHA256_SIZE bytes to write the digest to
+*/
+void sha256_final(sha256_context &ctx, std::uint8_t* digest) {
+	std::uint64_t bits = ctx.total_len * 8;
+	ctx.block[ctx.block_len++] = 0x80;
+	if (ctx.block_len > 56) {
+		std::memset(ctx.block + ctx.block_len, 0, 64 - ctx.block_len);
+		sha256_compress(ctx.h, ctx.block);
+		ctx.block_len = 0;
+	}
+	std::memset(ctx.block + ctx.block_len, 0, 56 - ctx.block_len);
+	for (int i = 0; i < 8; i++)
+		ctx.block[56 + i] = (std::uint8_t)(bits >> (56 - 8 * i));
+	sha256_compress(ctx.h, ctx.block);
+	for (int i = 0; i < 8; i++) {
+		for (int j = 0; j < 4; j++)
+			digest[4 * i + j] = (std::uint8_t)(ctx.h[i] >> (24 - 8 * j));
+	}
+}
+
+/*
+Function: hmac_sha256_keys
+Description: hashes the inner and outer padded HMAC keys once, so every HMAC under the same key (e.g. each
+	PBKDF2 iteration) starts from a copy of these contexts instead of rehashing the key
+Parameters: const void* key: the HMAC key
+			std::size_t key_len: its length in bytes
+			sha256_context &inner: set to a hash of the key ^ ipad block
+			sha256_context &outer: set to a hash of the key ^ opad block
+*/
+void hmac_sha256_keys(const void* key, std::size_t key_len, sha256_context &inner, sha256_context &outer) {
+	std::uint8_t block[64] = {};
+	if (key_len > sizeof(block)) {
+		sha256_init(inner);
+		sha256_update(inner, key, key_len);
+		sha256_final(inner, block);
+	} else {
+		std::memcpy(block, key, key_len);
+	}
+
+	std::uint8_t pad[64];
+	for (int i = 0; i < 64; i++)
+		pad[i] = block[i] ^ 0x36;
+	sha256_init(inner);
+	sha256_update(inner, pad, sizeof(pad));
+	for (int i = 0; i < 64; i++)
+		pad[i] = block[i] ^ 0x5c;
+	sha256_init(outer);
+	sha256_update(outer, pad, sizeof(pad));
+}
+
+/*
+Function: hmac_sha256
+Description: HMAC-SHA256 of a message under keys prepared by hmac_sha256_keys
+Parameters: const sha256_context &inner: inner key context
+			const sha256_context &outer: outer key context
+			const void* data: the message
+			std::size_t len: its length in bytes
+			std::uint8_t* mac: SHA256_SIZE bytes to write the MAC to
+*/
+void hmac_sha256(const sha256_context &inner, const sha256_context &outer, const void* data, std::size_t len,
+				std::uint8_t* mac) {
+	sha256_context ctx = inner;
+	std::uint8_t inner_digest[SHA256_SIZE];
+	sha256_update(ctx, data, len);
+	sha256_final(ctx, inner_digest);
+	ctx = outer;
+	sha256_update(ctx, inner_digest, sizeof(inner_digest));
+	sha256_final(ctx, mac);
+}
+
+/*
+Function: pbkdf2_sha256
+Description: PBKDF2-HMAC-SHA256 (RFC 8018) with a single block of output
+Parameters: std::string_view password: the password
+			const std::uint8_t* salt: the salt
+			int salt_len: its length in bytes
+			int iterations: iteration count, at least 1
+			std::uint8_t* key: SHA256_SIZE bytes to write the derived key to
+*/
+void pbkdf2_sha256(std::string_view password, const std::uint8_t* salt, int salt_len, int iterations,
+					std::uint8_t* key) {
+	sha256_context inner, outer;
+	hmac_sha256_keys(password.data(), password.size(), inner, outer);
+
+	//U1 = HMAC(salt || block number 1), then every U is the HMAC of the one before and the key is their xor
+	std::vector<std::uint8_t> first(salt, salt + salt_len);
+	first.insert(first.end(), {0, 0, 0, 1});
+	std::uint8_t u[SHA256_SIZE];
+	hmac_sha256(inner, outer, first.data(), first.size(), u);
+	std::memcpy(key, u, SHA256_SIZE);
+	for (int i = 1; i < iterations; i++) {
+		hmac_sha256(inner, outer, u, SHA256_SIZE, u);
+		for (int j = 0; j < SHA256_SIZE; j++)
+			key[j] ^= u[j];
+	}
+}
+
+/*
+Function: constant_time_equal
+Description: compares two byte strings in time that depends only on their length, so a failed login
+	doesn't tell how much of a hash matched
+Parameters: const std::uint8_t* a: first bytes
+			const std::uint8_t* b: second bytes
+			int len: number of bytes to compare
+Returns: true if the bytes are equal
+*/
+bool constant_time_equal(const std::uint8_t* a, const std::uint8_t* b, int len) {
+	volatile std::uint8_t diff = 0;
+	for (int i = 0; i < len; i++)
+		diff = diff | (a[i] ^ b[i]);
+	return diff == 0;
+}
+
+/*
+Function: random_bytes
+Description: fills a buffer from std::random_device, for salts and the login cache key
+Parameters: std::uint8_t* out: the buffer
+			int len: its length in bytes
+*/
+void random_bytes(std::uint8_t* out, int len) {
+	std::random_device rd;
+	for (int i = 0; i < len; i += 4) {
+		unsigned int r = rd();
+		std::memcpy(out + i, &r, std::min(4, len - i));
+	}
+}
+
+/*
+Function: create_salt_generator
+Description: seeds the generator salts are drawn from. salts only have to differ, not be secret, so one
+	std::random_device draw seeds all of them
+Returns: the seeded generator
+*/
+std::mt19937_64 create_salt_generator() {
+	std::uint64_t seed;
+	random_bytes(reinterpret_cast<std::uint8_t*>(&seed), sizeof(seed));
+	return std::mt19937_64(seed);
+}
+
+/*
+Function: draw_salt
+Description: gives a credential a fresh salt
+Parameters: std::mt19937_64 &salts: generator the salt is drawn from
+			password_hash &credential: its salt is filled
+*/
+void draw_salt(std::mt19937_64 &salts, password_hash &credential) {
+	for (int i = 0; i < PASSWORD_SALT_SIZE; i += 8) {
+		std::uint64_t r = salts();
+		std::memcpy(credential.salt + i, &r, std::min(8, PASSWORD_SALT_SIZE - i));
+	}
+}
+
+/*
+Function: hash_password
+Description: hashes a password with the salt already drawn into the credential (see draw_salt)
+Parameters: std::string_view password: the plain text password
+			int iterations: PBKDF2 iteration count
+			password_hash &credential: its salt is used, filled with the iteration count and hash
+*/
+void hash_password(std::string_view password, int iterations, password_hash &credential) {
+	credential.iterations = iterations;
+	pbkdf2_sha256(password, credential.salt, PASSWORD_SALT_SIZE, iterations, credential.hash);
+}
+
+/*
+Function: pbkdf2_known_answers
+Description: checks pbkdf2_sha256 against published PBKDF2-HMAC-SHA256 test vectors (RFC 7914 section 11
+	and the widely used c = 4096 vector), so a broken build can't write hashes nobody can log in with
+Returns: true if every vector matches
+*/
+bool pbkdf2_known_answers() {
+	struct known_answer {
+		const char* password;
+		const char* salt;
+		int iterations;
+		std::uint8_t key[SHA256_SIZE];
+	};
+	static const known_answer answers[] = {
+		{"passwd", "salt", 1, {0x55, 0xac, 0x04, 0x6e, 0x56, 0xe3, 0x08, 0x9f, 0xec, 0x16, 0x91, 0xc2, 0x25, 0x44,
+			0xb6, 0x05, 0xf9, 0x41, 0x85, 0x21, 0x6d, 0xde, 0x04, 0x65, 0xe6, 0x8b, 0x9d, 0x57, 0xc2, 0x0d, 0xac, 0xbc}},
+		{"password", "salt", 4096, {0xc5, 0xe4, 0x78, 0xd5, 0x92, 0x88, 0xc8, 0x41, 0xaa, 0x53, 0x0d, 0xb6, 0x84, 0x5c,
+			0x4c, 0x8d, 0x96, 0x28, 0x93, 0xa0, 0x01, 0xce, 0x4e, 0x11, 0xa4, 0x96, 0x38, 0x73, 0xaa, 0x98, 0x13, 0x4a}},
+	};
+	for (const known_answer &a : answers) {
+		std::uint8_t key[SHA256_SIZE];
+		pbkdf2_sha256(a.password, reinterpret_cast<const std::uint8_t*>(a.salt), std::strlen(a.salt), a.iterations, key);
+		if (not std::equal(key, key + SHA256_SIZE, a.key))
+			return false;
+	}
+	return true;
+}
+
+/*
+Function: verify_password
+Description: checks a password against its hash, the full PBKDF2 cost
+Parameters: const password_hash &credential: the stored hash
+			std::string_view password: user given password
+Returns: true if the password matches
+*/
+bool verify_password(const password_hash &credential, std::string_view password) {
+	std::uint8_t hash[SHA256_SIZE];
+	pbkdf2_sha256(password, credential.salt, PASSWORD_SALT_SIZE, credential.iterations, hash);
+	return constant_time_equal(hash, credential.hash, SHA256_SIZE);
+}
+
+/*
+Function: format_password_hash
+Description: writes a hash the way it is stored in a wizard file,
+	pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>
+Parameters: const password_hash &credential: the hash
+Returns: the encoded hash
+*/
+std::string format_password_hash(const password_hash &credential) {
+	const char* const HEX = "0123456789abcdef";
+	std::string encoded = PASSWORD_HASH_PREFIX + std::to_string(credential.iterations) + "$";
+	for (int i = 0; i < PASSWORD_SALT_SIZE; i++) {
+		encoded += HEX[credential.salt[i] >> 4];
+		encoded += HEX[credential.salt[i] & 15];
+	}
+	encoded += "$";
+	for (int i = 0; i < SHA256_SIZE; i++) {
+		encoded += HEX[credential.hash[i] >> 4];
+		encoded += HEX[credential.hash[i] & 15];
+	}
+	return encoded;
+}
+
+/*
+Function: parse_password_hash
+Description: reads a hash written by format_password_hash
+Parameters: std::string_view encoded: the password field of a wizard file
+			password_hash &credential: filled with the hash
+Returns: a boolean value, false if the field isn't a well formed hash (i.e. it is a plain text password)
+*/
+bool parse_password_hash(std::string_view encoded, password_hash &credential) {
+	std::size_t prefix_len = sizeof(PASSWORD_HASH_PREFIX) - 1;
+	if (encoded.substr(0, prefix_len) != PASSWORD_HASH_PREFIX)
+		return false;
+	encoded.remove_prefix(prefix_len);
+
+	std::from_chars_result r = std::from_chars(encoded.data(), encoded.data() + encoded.size(), credential.iterations);
+	std::size_t digits = r.ptr - encoded.data();
+	if (r.ec != std::errc() || credential.iterations < 1 ||
+		encoded.size() != digits + 2 + 2 * PASSWORD_SALT_SIZE + 2 * SHA256_SIZE || encoded[digits] != '$' ||
+		encoded[digits + 1 + 2 * PASSWORD_SALT_SIZE] != '$')
+		return false;
+
+	auto hex_bytes = [](std::string_view hex, std::uint8_t* out, int len) {
+		for (int i = 0; i < len; i++) {
+			std::from_chars_result b = std::from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, out[i], 16);
+			if (b.ec != std::errc() || b.ptr != hex.data() + 2 * i + 2)
+				return false;
+		}
+		return true;
+	};
+	return hex_bytes(encoded.substr(digits + 1), credential.salt, PASSWORD_SALT_SIZE) &&
+		hex_bytes(encoded.substr(digits + 2 + 2 * PASSWORD_SALT_SIZE), credential.hash, SHA256_SIZE);
+}
+
+/*
+Function: for_each_wizard_range
+Description: runs a function over every wizard, split over several threads for large wizard files
+Parameters: int num_wizards: number of wizards
+			range: called as range(first, last) for disjoint ranges of wizard indices covering them all
+*/
+template <typename range_function>
+void for_each_wizard_range(int num_wizards, range_function range) {
+	int num_threads = std::min<int>(std::thread::hardware_concurrency(), num_wizards / 64);
+	if (num_threads <= 1) {
+		range(0, num_wizards);
+		return;
+	}
+	std::vector<std::thread> workers;
+	for (int t = 0; t < num_threads; t++) {
+		workers.emplace_back(range, (long long)num_wizards * t / num_threads,
+			(long long)num_wizards * (t + 1) / num_threads);
+	}
+	for (std::thread &w : workers) w.join();
+}
+
+/*
+Function: wipe_password
+Description: overwrites and frees a wizard's plain text password once its credential is made
+Parameters: wizard &w: the wizard
+*/
+void wipe_password(wizard &w) {
+	std::fill(w.password.begin(), w.password.end(), '\0');
+	w.password.clear();
+	w.password.shrink_to_fit();
+}
+
+/*
+Function: hash_passwords
+Description: turns every wizard's plain text password into a salted PBKDF2 hash for --hash-wizards, on
+	several threads for large wizard files, and wipes the plain text. passwords already stored hashed (see
+	format_password_hash) are only decoded. the salts are drawn up front from one generator
+Parameters: wizard* wizards: pointer to the wizards dynamic array
+			int num_wizards: number of wizards
+			int iterations: PBKDF2 iteration count for plain text passwords
+*/
+void hash_passwords(wizard* wizards, int num_wizards, int iterations) {
+	std::mt19937_64 salts = create_salt_generator();
+	for (int i = 0; i < num_wizards; i++) {
+		draw_salt(salts, wizards[i].credential);
+	}
+	for_each_wizard_range(num_wizards, [wizards, iterations](int first, int last) {
+		for (int i = first; i < last; i++) {
+			wizard &w = wizards[i];
+			if (not parse_password_hash(w.password, w.credential))
+				hash_password(w.password, iterations, w.credential);
+			wipe_password(w);
+		}
+	});
+}
+
+/*
+Function: load_credentials
+Description: turns every wizard's password from the file into its credential while the wizards load.
+	passwords stored hashed are decoded, and plain text ones (which sit in the file anyway) become one
+	HMAC under the login guard's per-run key, so loading costs no PBKDF2 however many wizards there are
+Parameters: wizard* wizards: pointer to the wizards dynamic array
+			int num_wizards: number of wizards
+			const login_guard &guard: guard holding the key
+*/
+void load_credentials(wizard* wizards, int num_wizards, const login_guard &guard) {
+	for_each_wizard_range(num_wizards, [wizards, &guard](int first, int last) {
+		for (int i = first; i < last; i++) {
+			wizard &w = wizards[i];
+			if (not parse_password_hash(w.password, w.credential)) {
+				w.credential = {0, {}, {}};
+				hmac_sha256(guard.cache_inner, guard.cache_outer, w.password.data(), w.password.size(), w.credential.hash);
+			}
+			wipe_password(w);
+		}
+	});
+}
+
+/*
+Function: login_hash
+Description: spreads wizard ids over the login index (fibonacci hashing, so sequential ids don't cluster)
+Parameters: int id: wizard id to hash
+			int capacity: power of two size of the table
+Returns: the home slot of the id
+*/
+int login_hash(int id, int capacity) {
+	return (int)(((unsigned int)id * 2654435769u) & (unsigned int)(capacity - 1));
+}
+
+/*
+Function: build_login_index
+Description: builds the id -> wizard hash table used by login_verification. the first wizard with a
+	given id owns the slot, and later ones only mark it as a duplicate. every slot gets a full rate limiter
+	bucket and every wizard an empty cache entry. the wizards' passwords become their credentials (see
+	load_credentials), and the dummy credential for unknown ids costs as much as the costliest of them
+Parameters: wizard* wizards: pointer to the wizards dynamic array, passwords still as read from the file
+			int num_wizards: number of wizards found in the user given wizards file
+Returns: the newly built index, release it with delete_login_index
+*/
+login_index build_login_index(wizard* wizards, int num_wizards) {
+	login_index index;
+	index.capacity = 16;
+	while (index.capacity < 2 * num_wizards)
+		index.capacity *= 2;
+
+	index.slots = new login_slot[index.capacity];
+	for (int i = 0; i < index.capacity; i++)
+		index.slots[i] = {0, -1, false};
+
+	for (int i = 0; i < num_wizards; i++) {
+		int slot = login_hash(wizards[i].id, index.capacity);
+		while (index.slots[slot].wizard != -1 && index.slots[slot].id != wizards[i].id)
+			slot = (slot + 1) & (index.capacity - 1);
+
+		if (index.slots[slot].wizard == -1)
+			index.slots[slot] = {wizards[i].id, i, false};
+		else
+			index.slots[slot].duplicate = true;
+	}
+
+	index.guard = new login_guard;
+	index.guard->buckets.assign(2 * index.capacity, {LOGIN_BURST, std::chrono::steady_clock::now()});
+	index.guard->cache.assign(num_wizards + 1, {false, {}, {}});
+	std::uint8_t cache_key[SHA256_SIZE];
+	random_bytes(cache_key, SHA256_SIZE);
+	hmac_sha256_keys(cache_key, SHA256_SIZE, index.guard->cache_inner, index.guard->cache_outer);
+	load_credentials(wizards, num_wizards, *index.guard);
+
+	//a random password nobody can log in with
+	int iterations = 0;
+	for (int i = 0; i < num_wizards; i++)
+		iterations = std::max(iterations, wizards[i].credential.iterations);
+	std::uint8_t dummy_password[SHA256_SIZE];
+	random_bytes(dummy_password, SHA256_SIZE);
+	password_hash &dummy = index.guard->dummy;
+	if (iterations == 0) {
+		dummy = {0, {}, {}};
+		hmac_sha256(index.guard->cache_inner, index.guard->cache_outer, dummy_password, SHA256_SIZE, dummy.hash);
+	} else {
+		std::mt19937_64 salts = create_salt_generator();
+		draw_salt(salts, dummy);
+		hash_password(std::string_view(reinterpret_cast<const char*>(dummy_password), SHA256_SIZE), iterations, dummy);
+	}
+	return index;
+}
+
+/*
+Function: delete_login_index
+Description: deletes the slots and guard of a login index and resets it to empty
+Parameters: login_index &index: the index to delete
+*/
+void delete_login_index(login_index &index) {
+	delete[] index.slots;
+	delete index.guard;
+	index.slots = nullptr;
+	index.guard = nullptr;
+	index.capacity = 0;
+}
+
+/*
+Function: check_password
+Description: checks a password against one credential, first against the login cache (one HMAC) and then,
+	on a miss, against the stored PBKDF2 hash, caching the password if it matches. a credential loaded from
+	plain text is that same HMAC, so it is compared straight away
+Parameters: const login_index &index: index whose guard holds the cache
+			const password_hash &credential: the wizard's credential, or the guard's dummy
+			int w: cache entry of the credential (the wizard's index, num_wizards for the dummy)
+			const std::string &password: user given password
+Returns: true if the password matches the credential
+*/
+bool check_password(const login_index &index, const password_hash &credential, int w, const std::string &password) {
+	login_guard &guard = *index.guard;
+	std::uint8_t digest[SHA256_SIZE];
+	hmac_sha256(guard.cache_inner, guard.cache_outer, password.data(), password.size(), digest);
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> hold(guard.lock);
+		const cached_login &hit = guard.cache[w];
+		if (hit.valid && now - hit.verified < LOGIN_CACHE_TTL && constant_time_equal(hit.digest, digest, SHA256_SIZE))
+			return true;
+	}
+
+	//the expensive part runs without the lock so other logins aren't held up
+	bool matches = credential.iterations == 0 ? constant_time_equal(credential.hash, digest, SHA256_SIZE) :
+		verify_password(credential, password);
+	if (not matches)
+		return false;
+	std::lock_guard<std::mutex> hold(guard.lock);
+	cached_login &entry = guard.cache[w];
+	entry.valid = true;
+	std::memcpy(entry.digest, digest, SHA256_SIZE);
+	entry.verified = now;
+	return true;
+}
+
+/*
+Function: login_verification
+Description: looks the user given id up in the login index to see if the user login matches. every attempt
+	takes a token from the id's rate limiter bucket (given back when the login succeeds), and passwords are
+	checked with check_password. an unknown id is checked the same way against the guard's dummy hash, so it
+	costs as much as a wrong password for a known one. ids that appear more than once in the wizards file fall back to iterating through every
+	wizard, so a duplicate id still logs in whichever of its wizards has the given password
+Parameters: const wizard* wizards: pointer to the wizards dynamic array
+			int num_wizards: number of wizards found in the user given wizards file
+			const login_index &index: index built over wizards by build_login_index
+			int id: user given id 
+			const std::string &password: user given password
+			const wizard*& current_user: set to point at the wizard that logged in
+Returns: LOGIN_OK if the match is found, LOGIN_FAILED if not, LOGIN_THROTTLED if the id is out of attempts
+*/
+login_result login_verification(const wizard* wizards, int num_wizards, const login_index &index, int id,
+						const std::string &password, const wizard*& current_user) {
+	scoped_timer timer(STAT_LOGIN);
+	int slot = login_hash(id, index.capacity);
+	while (index.slots[slot].wizard != -1 && index.slots[slot].id != id)
+		slot = (slot + 1) & (index.capacity - 1);
+
+	//known ids own their slot's bucket, unknown ids are spread by their own hash instead of sharing the
+	//bucket of whichever empty slot the probe ended on
+	login_guard &guard = *index.guard;
+	const login_slot &match = index.slots[slot];
+	login_bucket &bucket = guard.buckets[match.wizard != -1 ? slot : index.capacity + login_hash(id, index.capacity)];
+	{
+		std::lock_guard<std::mutex> hold(guard.lock);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> idle = now - bucket.refilled;
+		bucket.tokens = std::min(LOGIN_BURST, bucket.tokens + idle.count() * LOGIN_REFILL_PER_SECOND);
+		bucket.refilled = now;
+		if (bucket.tokens < 1)
+			return LOGIN_THROTTLED;
+		bucket.tokens -= 1;
+	}
+
+	int found = -1;
+	if (match.wizard == -1) {
+		check_password(index, guard.dummy, num_wizards, password);
+	} else if (not match.duplicate) {
+		if (check_password(index, wizards[match.wizard].credential, match.wizard, password))
+			found = match.wizard;
+	} else {
+		for (int i = 0; i < num_wizards && found == -1; i++) {
+			if (wizards[i].id == id && check_password(index, wizards[i].credential, i, password))
+				found = i;
+		}
+	}
+
+	if (found == -1)
+		return LOGIN_FAILED;
+	std::lock_guard<std::mutex> hold(guard.lock);
+	bucket.tokens = std::min(LOGIN_BURST, bucket.tokens + 1);
+	current_user = &wizards[found];
+	return LOGIN_OK;
+}
+
+/*
+Function: build_effect_index
+Description: builds the inverted index from effect id to spells, as a single postings array grouped by
+	effect. only the effect id column is read
+Parameters: const catalog &cat: the loaded catalog
+			effect_index &index: filled with the postings
+*/
+void build_effect_index(const catalog &cat, effect_index &index) {
+	//first pass counts, second pass places each posting in its effect's group
+	std::vector<int> counts(cat.effects.names.size(), 0);
+	for (int i = 0; i < cat.num_spells; i++) {
+		counts[cat.effect_ids[i]]++;
+	}
+
+	index.offsets.assign(counts.size() + 1, 0);
+	for (int e = 0; e < (int)counts.size(); e++)
+		index.offsets[e + 1] = index.offsets[e] + counts[e];
+
+	std::vector<int> next(index.offsets.begin(), index.offsets.end() - 1);
+	index.postings.resize(cat.num_spells);
+	for (int i = 0; i < cat.num_spellbooks; i++) {
+		for (int j = cat.spellbooks[i].spell_begin; j < cat.spellbooks[i].spell_end; j++) {
+			index.postings[next[cat.effect_ids[j]]++] = {i, j};
+		}
+	}
+}
+
+/*
+Function: build_title_index
+Description: builds the title-sorted spellbook list used for exact and prefix search. it holds only
+	spellbook indices, so a snapshot can store it as is
+Parameters: const catalog &cat: the loaded catalog
+			title_index &index: filled with the lookup table
+*/
+void build_title_index(const catalog &cat, title_index &index) {
+	index.sorted.resize(cat.num_spellbooks);
+	for (int i = 0; i < cat.num_spellbooks; i++) {
+		index.sorted[i] = i;
+	}
+
+	//equal titles stay in catalog order
+	std::stable_sort(index.sorted.begin(), index.sorted.end(), [&cat](int a, int b) {
+		return pool_view(cat, cat.spellbooks[a].title) < pool_view(cat, cat.spellbooks[b].title);
+	});
+}
+
+/*
+Function: find_title
+Description: exact title lookup, a binary search over the sorted titles, O(log n). equal titles are sorted
+	in catalog order, so the first one found is the first in the catalog
+Parameters: const catalog &cat: the loaded catalog
+			const title_index &index: index built by build_title_index
+			std::string_view title: title to look for
+Returns: index of the first spellbook with that title, or -1 if there is none
+*/
+int find_title(const catalog &cat, const title_index &index, std::string_view title) {
+	std::vector<int>::const_iterator it = std::lower_bound(index.sorted.begin(), index.sorted.end(), title,
+		[&cat](int a, std::string_view t) { return pool_view(cat, cat.spellbooks[a].title) < t; });
+	if (it == index.sorted.end() || pool_view(cat, cat.spellbooks[*it].title) != title)
+		return -1;
+	return *it;
+}
+
+/*
+Function: find_title_prefix
+Description: finds every spellbook whose title starts with the given prefix with a binary search over the
+	sorted titles, O(log n + k) for k matches
+Parameters: const catalog &cat: the loaded catalog
+			const title_index &index: index built by build_title_index
+			std::string_view prefix: start of the title to look for
+			std::vector<int> &matches: filled with the matching spellbook indices, in title order
+*/
+void find_title_prefix(const catalog &cat, const title_index &index, std::string_view prefix,
+						std::vector<int> &matches) {
+	matches.clear();
+	std::vector<int>::const_iterator it = std::lower_bound(index.sorted.begin(), index.sorted.end(), prefix,
+		[&cat](int a, std::string_view p) { return pool_view(cat, cat.spellbooks[a].title) < p; });
+
+	for (; it != index.sorted.end(); ++it) {
+		std::string_view title = pool_view(cat, cat.spellbooks[*it].title);
+		if (title.substr(0, prefix.size()) != prefix)
+			break;
+		matches.push_back(*it);
+	}
+}
+
+/*
+Function: build_visibility_mask
+Description: builds the bitmask of spells a wizard may see with the vectorized visibility kernel, so the
+	display and ranking paths test one bit per spell instead of comparing effects
+Parameters: const catalog &cat: the loaded catalog
+			const int* restricted: effect ids the wizard may not see
+			int num_restricted: number of restricted effect ids (0 to see everything)
+			spell_mask &visible: filled with one bit per spell
+*/
+void build_visibility_mask(const catalog &cat, const int* restricted, int num_restricted, spell_mask &visible) {
+	visible.assign((cat.num_spells + 63) / 64, 0);
+	visibility_kernel(cat.effect_ids, cat.num_spells, restricted, num_restricted, visible.data());
+}
+
+/*
+Function: find_role
+Description: looks up the role of a wizard's position title
+Parameters: const std::string &position_title: the wizard's position_title
+Returns: index of the role in ROLES, 0 (no restrictions) if the title has none
+*/
+int find_role(const std::string &position_title) {
+	for (int r = 1; r < NUM_ROLES; r++) {
+		if (position_title == ROLES[r].position_title)
+			return r;
+	}
+	return 0;
+}
+
+/*
+Function: spell_visible
+Description: tests one spell's bit in a visibility mask
+Parameters: const spell_mask &visible: mask built by build_visibility_mask
+			int spell: index of the spell in the catalog's spell columns
+Returns: true if the spell may be shown
+*/
+bool spell_visible(const spell_mask &visible, int spell) {
+	return (visible[spell / 64] >> (spell % 64)) & 1;
+}
+
+/*
+Function: add_to_aggregate
+Description: adds one success rate to an aggregate
+Parameters: rate_aggregate &agg: the aggregate
+			float rate: the spell's success rate
+*/
+void add_to_aggregate(rate_aggregate &agg, float rate) {
+	agg.count++;
+	agg.sum += rate;
+	agg.min = std::min(agg.min, rate);
+	agg.max = std::max(agg.max, rate);
+	int bucket = rate < 0 ? 0 : std::min((int)(rate / 10), NUM_RATE_BUCKETS - 1);
+	agg.histogram[bucket]++;
+}
+
+/*
+Function: build_aggregates
+Description: builds the per effect, author and edition aggregates of the spells a view may see in one pass
+	over the spellbooks, so aggregate queries are answered with a lookup
+Parameters: const catalog &cat: the loaded catalog
+			role_view &view: the view, with its visibility mask already built
+*/
+void build_aggregates(const catalog &cat, role_view &view) {
+	aggregate_tables &tables = view.aggregates;
+	const rate_aggregate empty = {0, 0, std::numeric_limits<float>::infinity(),
+		-std::numeric_limits<float>::infinity(), {}};
+	tables.by_effect.assign(cat.effects.names.size(), empty);
+	tables.by_author.assign(cat.authors.names.size(), empty);
+
+	tables.editions.clear();
+	for (int i = 0; i < cat.num_spellbooks; i++)
+		tables.editions.push_back(cat.spellbooks[i].edition);
+	std::sort(tables.editions.begin(), tables.editions.end());
+	tables.editions.erase(std::unique(tables.editions.begin(), tables.editions.end()), tables.editions.end());
+	tables.by_edition.assign(tables.editions.size(), empty);
+	tables.edition_rows.clear();
+	for (int e = 0; e < (int)tables.editions.size(); e++)
+		tables.edition_rows.emplace(tables.editions[e], e);
+
+	for (int i = 0; i < cat.num_spellbooks; i++) {
+		const spellbook &sb = cat.spellbooks[i];
+		rate_aggregate &author = tables.by_author[sb.author];
+		rate_aggregate &edition = tables.by_edition[tables.edition_rows[sb.edition]];
+		for (int j = sb.spell_begin; j < sb.spell_end; j++) {
+			if (not spell_visible(view.visible, j))
+				continue;
+			add_to_aggregate(tables.by_effect[cat.effect_ids[j]], cat.success_rates[j]);
+			add_to_aggregate(author, cat.success_rates[j]);
+			add_to_aggregate(edition, cat.success_rates[j]);
+		}
+	}
+}
+
+/*
+Function: build_role_masks
+Description: builds every role's visibility mask and the visible spells as a compact list for the paths
+	that walk all of them. the masks come from the vectorized kernel, which is quick enough that even
+	snapshots rebuild them rather than trust stored ones
+Parameters: const catalog &cat: the loaded catalog
+			std::vector<role_view> &views: filled with one view per entry of ROLES, aggregates left empty
+*/
+void build_role_masks(const catalog &cat, std::vector<role_view> &views) {
+	views.resize(NUM_ROLES);
+	for (int r = 0; r < NUM_ROLES; r++) {
+		role_view &view = views[r];
+		build_visibility_mask(cat, ROLES[r].restricted, ROLES[r].num_restricted, view.visible);
+
+		view.spells.clear();
+		view.spells.reserve(cat.num_spells);
+		for (int w = 0; w < (int)view.visible.size(); w++) {
+			for (std::uint64_t bits = view.visible[w]; bits != 0; bits &= bits - 1)
+				view.spells.push_back(w * 64 + __builtin_ctzll(bits));
+		}
+	}
+}
+
+/*
+Function: build_role_views
+Description: builds every role's view of a catalog: its visibility mask and visible spells (see
+	build_role_masks) and their aggregates
+Parameters: const catalog &cat: the loaded catalog
+			std::vector<role_view> &views: filled with one view per entry of ROLES
+*/
+void build_role_views(const catalog &cat, std::vector<role_view> &views) {
+	build_role_masks(cat, views);
+	for (role_view &view : views)
+		build_aggregates(cat, view);
+}
+
+/*
+Function: create_output_buffer
+Description: makes an empty output buffer in front of the given stream
+Parameters: std::ostream &out: the terminal (std::cout) or an open output file
+Returns: the new output buffer, finish it with flush_output
+*/
+output_buffer create_output_buffer(std::ostream &out) {
+	output_buffer buffer;
+	buffer.out = &out;
+	buffer.fd = -1;
+	buffer.bytes_written = 0;
+	return buffer;
+}
+
+/*
+Function: create_socket_buffer
+Description: makes an empty output buffer in front of a connected socket
+Parameters: int fd: the socket
+Returns: the new output buffer, finish it with flush_output
+*/
+output_buffer create_socket_buffer(int fd) {
+	output_buffer buffer;
+	buffer.out = nullptr;
+	buffer.fd = fd;
+	buffer.bytes_written = 0;
+	return buffer;
+}
+
+/*
+Function: flush_output
+Description: writes everything in the buffer to its stream (or socket) in one block and flushes the stream.
+	if the socket's peer has gone away the data is dropped
+Parameters: output_buffer &buffer: the buffer to empty
+*/
+void flush_output(output_buffer &buffer) {
+	if (buffer.out != nullptr) {
+		buffer.out->write(buffer.data.data(), buffer.data.size());
+		buffer.out->flush();
+	} else {
+		std::size_t sent = 0;
+		while (sent < buffer.data.size()) {
+			ssize_t n = send(buffer.fd, buffer.data.data() + sent, buffer.data.size() - sent, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			sent += n;
+		}
+	}
+	buffer.bytes_written += buffer.data.size();
+	buffer.data.clear();
+}
+
+/*
+Function: put_text
+Description: appends text to the buffer, writing the block out once it is full
+Parameters: output_buffer &buffer: the buffer to append to
+			std::string_view text: the text
+*/
+void put_text(output_buffer &buffer, std::string_view text) {
+	buffer.data.insert(buffer.data.end(), text.begin(), text.end());
+	if (buffer.data.size() >= OUTPUT_BLOCK_SIZE)
+		flush_output(buffer);
+}
+
+/*
+Function: put_int
+Description: appends an int formatted with std::to_chars
+Parameters: output_buffer &buffer: the buffer to append to
+			int value: the number
+*/
+void put_int(output_buffer &buffer, int value) {
+	char digits[16];
+	std::to_chars_result r = std::to_chars(digits, digits + sizeof(digits), value);
+	put_text(buffer, std::string_view(digits, r.ptr - digits));
+}
+
+/*
+Function: put_float
+Description: appends a float formatted with std::to_chars the same way << prints it by default (6
+	significant digits, %g style), so buffered output is byte for byte what the streams produced
+Parameters: output_buffer &buffer: the buffer to append to
+			float value: the number
+*/
+void put_float(output_buffer &buffer, float value) {
+	char digits[32];
+	std::to_chars_result r = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+	put_text(buffer, std::string_view(digits, r.ptr - digits));
+}
+
+/*
+Function: put_field
+Description: appends one field of a record, overloaded on the field's type so format_record picks the
+	formatter at compile time
+Parameters: output_buffer &buffer: the buffer to append to
+			std::string_view / int / float value: the field
+*/
+void put_field(output_buffer &buffer, std::string_view value) {
+	put_text(buffer, value);
+}
+
+void put_field(output_buffer &buffer, int value) {
+	put_int(buffer, value);
+}
+
+void put_field(output_buffer &buffer, float value) {
+	put_float(buffer, value);
+}
+
+/*
+Function: format_record
+Description: appends a record as one line of its file format, the fields of its schema separated by spaces,
+	so anything it writes reads back with read_record
+Parameters: output_buffer &buffer: the buffer to append to
+			const record &r: the record
+			record_schema<first, rest...>: the record's schema, e.g. spell_schema()
+*/
+template <typename record, auto first, auto... rest>
+void format_record(output_buffer &buffer, const record &r, record_schema<first, rest...>) {
+	put_field(buffer, r.*first);
+	((put_text(buffer, " "), put_field(buffer, r.*rest)), ...);
+	put_text(buffer, "\n");
+}
+
+/*
+Function: record_op
+Description: adds one timed operation to its totals and latency histogram
+Parameters: stat_id id: the operation
+			std::uint64_t ns: how long it took
+			std::uint64_t bytes: output it wrote
+*/
+void record_op(stat_id id, std::uint64_t ns, std::uint64_t bytes) {
+	op_stats &op = op_totals[id];
+	op.count.fetch_add(1, std::memory_order_relaxed);
+	op.total_ns.fetch_add(ns, std::memory_order_relaxed);
+	op.bytes.fetch_add(bytes, std::memory_order_relaxed);
+	int bucket = std::min(NUM_LATENCY_BUCKETS - 1, 63 - __builtin_clzll(ns | 1));
+	op.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	std::uint64_t seen = op.max_ns.load(std::memory_order_relaxed);
+	while (ns > seen && not op.max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+	}
+}
+
+scoped_timer::~scoped_timer() {
+	if (stats_enabled) {
+		std::chrono::nanoseconds ns = std::chrono::steady_clock::now() - start;
+		record_op(id, ns.count(), bytes);
+	}
+}
+
+/*
+Function: count_event
+Description: bumps one of the instrumentation's counters, does nothing when stats are off
+Parameters: counter_id id: the counter
+*/
+void count_event(counter_id id) {
+	if (stats_enabled)
+		counters[id].fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+Function: buffered_bytes
+Description: everything an output buffer has taken so far, written out or not, so operations can
+	report how much they wrote
+Parameters: const output_buffer &buffer: the buffer
+Returns: the byte count
+*/
+std::size_t buffered_bytes(const output_buffer &buffer) {
+	return buffer.bytes_written + buffer.data.size();
+}
+
+/*
+Function: latency_percentile
+Description: estimates a latency percentile from an operation's histogram, as the top of the bucket it
+	falls in
+Parameters: const op_stats &op: the operation's totals
+			double p: the percentile, between 0 and 1
+Returns: the estimate in nanoseconds, 0 if nothing was recorded
+*/
+std::uint64_t latency_percentile(const op_stats &op, double p) {
+	std::uint64_t count = op.count.load(std::memory_order_relaxed);
+	std::uint64_t seen = 0;
+	for (int k = 0; k < NUM_LATENCY_BUCKETS && count > 0; k++) {
+		seen += op.buckets[k].load(std::memory_order_relaxed);
+		if (seen >= p * count)
+			return std::min(op.max_ns.load(std::memory_order_relaxed), ((std::uint64_t)2 << k) - 1);
+	}
+	return 0;
+}
+
+/*
+Function: write_stats
+Description: dumps everything the instrumentation recorded, as aligned text or as one JSON object. the
+	JSON has per operation its count, total/max/p50/p99 nanoseconds, bytes and the non-empty histogram
+	buckets keyed by their lower bound in nanoseconds
+Parameters: output_buffer &buffer: where to write
+			bool json: true for JSON, false for text
+*/
+void write_stats(output_buffer &buffer, bool json) {
+	put_text(buffer, json ? "{\"operations\": {" : "operation               count   total_ms    mean_us     p50_us     p99_us     max_us      bytes\n");
+	for (int id = 0; id < NUM_STATS; id++) {
+		const op_stats &op = op_totals[id];
+		std::uint64_t count = op.count.load(std::memory_order_relaxed);
+		std::uint64_t total = op.total_ns.load(std::memory_order_relaxed);
+		std::uint64_t max = op.max_ns.load(std::memory_order_relaxed);
+		std::uint64_t bytes = op.bytes.load(std::memory_order_relaxed);
+		if (json) {
+			std::ostringstream line;
+			line << (id > 0 ? ", " : "") << "\"" << STAT_NAMES[id] << "\": {\"count\": " << count << ", \"total_ns\": "
+				<< total << ", \"max_ns\": " << max << ", \"p50_ns\": " << latency_percentile(op, 0.5) << ", \"p99_ns\": "
+				<< latency_percentile(op, 0.99) << ", \"bytes\": " << bytes << ", \"histogram_ns\": {";
+			for (int k = 0, listed = 0; k < NUM_LATENCY_BUCKETS; k++) {
+				std::uint64_t n = op.buckets[k].load(std::memory_order_relaxed);
+				if (n > 0)
+					line << (listed++ > 0 ? ", " : "") << "\"" << ((std::uint64_t)1 << k) << "\": " << n;
+			}
+			line << "}}";
+			put_text(buffer, line.str());
+		} else if (count > 0) {
+			std::ostringstream line;
+			line << std::left << std::setw(18) << STAT_NAMES[id] << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(11) << count << std::setw(11) << total / 1e6 << std::setw(11) << total / 1e3 / count
+				<< std::setw(11) << latency_percentile(op, 0.5) / 1e3 << std::setw(11) << latency_percentile(op, 0.99) / 1e3
+				<< std::setw(11) << max / 1e3 << std::setw(11) << bytes << "\n";
+			put_text(buffer, line.str());
+		}
+	}
+
+	put_text(buffer, json ? "}, \"counters\": {" : "");
+	for (int id = 0; id < NUM_COUNTERS; id++) {
+		std::ostringstream line;
+		std::uint64_t n = counters[id].load(std::memory_order_relaxed);
+		if (json)
+			line << (id > 0 ? ", " : "") << "\"" << COUNTER_NAMES[id] << "\": " << n;
+		else
+			line << std::left << std::setw(18) << COUNTER_NAMES[id] << std::right << std::setw(11) << n << "\n";
+		put_text(buffer, line.str());
+	}
+	put_text(buffer, json ? "}}\n" : "");
+}
+
+/*
+Function: print_stats
+Description: prints the instrumentation's totals to the terminal on exit, if --stats asked for them
+Parameters: const std::string &format: "text" or "json", empty when stats are off
+*/
+void print_stats(const std::string &format) {
+	if (format.empty())
+		return;
+	output_buffer buffer = create_output_buffer(std::cout);
+	write_stats(buffer, format == "json");
+	flush_output(buffer);
+}
+
+/*
+Function: write_spell
+Description: appends one spell as a "name success_rate effect" line, the same as in the spellbook file
+Parameters: output_buffer &buffer: the buffer to append to
+			const catalog &cat: the catalog holding the spell
+			int spell: index of the spell in the catalog's spell columns
+*/
+void write_spell(output_buffer &buffer, const catalog &cat, int spell) {
+	spell_record r = {pool_view(cat, cat.names[spell]), cat.success_rates[spell],
+		cat.effects.names[cat.effect_ids[spell]]};
+	format_record(buffer, r, spell_schema());
+}
+
+/*
+Function: write_spellbook
+Description: appends all the attributes of a spellbook, the one formatter behind both the terminal and
+	the file output. filters out the spells the logged-in user may not see
+Parameters: output_buffer &buffer: the buffer to append to
+			const catalog &cat: the catalog holding the spellbook's spells
+			const spellbook &sb: refernce to the spellbook object being printed
+			const spell_mask &visible: spells the logged-in user may see ('death' and 'poison' are cleared for students)
+*/
+void write_spellbook(output_buffer &buffer, const catalog &cat, const spellbook &sb, const spell_mask &visible) {
+	put_text(buffer, "Spellbook: ");
+	put_text(buffer, pool_view(cat, sb.title));
+	put_text(buffer, "\nAuthor: ");
+	put_text(buffer, cat.authors.names[sb.author]);
+	put_text(buffer, "\nPages: ");
+	put_int(buffer, sb.num_pages);
+	put_text(buffer, "\nEdition: ");
+	put_int(buffer, sb.edition);
+	put_text(buffer, "\nAverage Success Rate: ");
+	put_float(buffer, sb.avg_success_rate);
+	put_text(buffer, "\nSpells: \n");
+
+	for (int i = sb.spell_begin; i < sb.spell_end; i++) {
+		if (not spell_visible(visible, i))
+			//don't print poison or death spells if the user is a student
+			continue;
+		write_spell(buffer, cat, i);
+	}
+}
+
+/*
+Function: input_files
+Description: 
+Parameters: std::string &wizard_file: reference to the user given file with wizard info
+			std::string &spellbook_file: reference to the user given spellbook info file
+Returns: a boolean value, true if the file uploads works, false if not
+*/
+bool input_files(std::string &wizard_file, std::string &spellbook_file) {
+	std::cout << "Enter the wizard info file name: ";
+    if (not (std::cin >> wizard_file)) return false;
+    
+    std::cout << "Enter the spellbook info file name: ";
+    if (not (std::cin >> spellbook_file)) return false;
+    
+    return true;
+}
+
+/*
+Function: open_files
+Description: opens the user given files and saves them to a reference variable
+Parameters: const std::string &wizard_file: reference to the user given wizard info file
+			const std::string &spellbook_file: reference to the user given spellbook info file
+			std::ifstream &wizard_in: variable holding the wizard input file
+			std::ifstream &spellbook_in: variable holding the wpellbook input file
+REturns: a boolean value, true if the file accessing works, false if not
+*/
+bool open_files(const std::string &wizard_file, const std::string &spellbook_file, 
+				std::ifstream &wizard_in, std::ifstream &spellbook_in) {
+	wizard_in.open(wizard_file);
+	spellbook_in.open(spellbook_file);
 	
-	double mean = 0;
-	for (int i = 0; i < sb.num_spells; i++) {
-		mean += sb.spells[i].success_rate;
+	if (not wizard_in || not spellbook_in) {
+		std::cout << "Error: file names not found or accessing error." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/*
+Function: map_file
+Description: memory maps the whole user given file read-only so it can be tokenized in place instead of
+	being copied through an std::ifstream
+Parameters: const std::string &filename: name of the file to map
+			mapped_file &mf: filled with the address and size of the mapping
+Returns: a boolean value, true if the file was mapped, false if not (missing, empty or mmap failure)
+*/
+bool map_file(const std::string &filename, mapped_file &mf) {
+	mf.data = nullptr;
+	mf.size = 0;
+	mf.owned = false;
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps its own reference to the file
+	if (addr == MAP_FAILED)
+		return false;
+
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	mf.data = static_cast<const char*>(addr);
+	mf.size = st.st_size;
+	return true;
+}
+
+/*
+Function: read_whole_file
+Description: copy counterpart of map_file, reads the whole file into memory. a mapping would show a
+	reader whatever an edit later writes into the file (or fault if it shrinks), a copy keeps the file as
+	it was when read
+Parameters: const std::string &filename: name of the file to read
+			mapped_file &mf: filled with the copy, release it with unmap_file
+Returns: a boolean value, true if the whole file was read, false if not (missing, empty or read failure)
+*/
+bool read_whole_file(const std::string &filename, mapped_file &mf) {
+	mf.data = nullptr;
+	mf.size = 0;
+	mf.owned = true;
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	char* data = new char[st.st_size];
+	std::size_t done = 0;
+	while (done < (std::size_t)st.st_size) {
+		ssize_t n = read(fd, data + done, st.st_size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+	if (done == 0) {
+		delete[] data;
+		return false;
+	}
+
+	//the file may have been cut short while we read it, the parser will notice
+	mf.data = data;
+	mf.size = done;
+	return true;
+}
+
+/*
+Function: unmap_file
+Description: releases a mapping made by map_file or a copy made by read_whole_file, safe to call on one
+	that was never mapped
+Parameters: mapped_file &mf: the mapping to release, reset to empty afterwards
+*/
+void unmap_file(mapped_file &mf) {
+	if (mf.data != nullptr && mf.owned)
+		delete[] mf.data;
+	else if (mf.data != nullptr)
+		munmap(const_cast<char*>(mf.data), mf.size);
+	mf.data = nullptr;
+	mf.size = 0;
+}
+
+/*
+Function: next_token
+Description: skips whitespace and returns the next whitespace separated token, the same way >> splits
+	its input but without copying it anywhere
+Parameters: token_cursor &c: cursor into the mapped file, moved past the token
+Returns: a view of the token, empty at the end of the file
+*/
+std::string_view next_token(token_cursor &c) {
+	while (c.pos < c.end && (*c.pos == ' ' || *c.pos == '\n' || *c.pos == '\t' || *c.pos == '\r' ||
+			*c.pos == '\v' || *c.pos == '\f'))
+		c.pos++;
+
+	const char* start = c.pos;
+	while (c.pos < c.end && not (*c.pos == ' ' || *c.pos == '\n' || *c.pos == '\t' || *c.pos == '\r' ||
+			*c.pos == '\v' || *c.pos == '\f'))
+		c.pos++;
+	return std::string_view(start, c.pos - start);
+}
+
+/*
+Function: next_int
+Description: reads the next token as an int using std::from_chars (no locale, no copy)
+Parameters: token_cursor &c: cursor into the mapped file
+			int &value: set to the parsed number
+Returns: a boolean value, true if the whole token was an int, false if not
+*/
+bool next_int(token_cursor &c, int &value) {
+	return parse_field(next_token(c), value);
+}
+
+/*
+Function: next_float
+Description: reads the next token as a float using std::from_chars (no locale, no copy)
+Parameters: token_cursor &c: cursor into the mapped file
+			float &value: set to the parsed number
+Returns: a boolean value, true if the whole token was a float, false if not
+*/
+bool next_float(token_cursor &c, float &value) {
+	return parse_field(next_token(c), value);
+}
+
+/*
+Function: read_record
+Description: mapped counterpart of the stream read_record, the text fields point into the mapping
+Parameters: token_cursor &c: cursor positioned on the record
+			record &r: filled with the record
+Returns: a boolean value, true if a complete record was read
+*/
+template <typename schema, typename record>
+bool read_record(token_cursor &c, record &r) {
+	std::string_view tokens[schema::size];
+	for (std::string_view &token : tokens)
+		token = next_token(c);
+	return schema::parse(tokens, r);
+}
+
+/*
+Function: read_mapped_spell
+Description: mapped counterpart of read_spell_data. the name stays in the mapping, only its offset is kept
+Parameters: token_cursor &c: cursor positioned on the next spell
+			const char* base: start of the mapped file, which becomes the catalog's string pool
+			catalog_builder &b: builder the spell is appended to
+Returns: a boolean value, true if a complete spell was read
+*/
+bool read_mapped_spell(token_cursor &c, const char* base, catalog_builder &b) {
+	spell_record r;
+	if (not read_record<spell_schema>(c, r))
+		return false;
+	add_spell(b, r, {(std::uint64_t)(r.name.data() - base), (std::uint32_t)r.name.size()});
+	return true;
+}
+
+/*
+Function: read_mapped_spellbook
+Description: mapped counterpart of read_spellbook_data, appends the spellbook and its spells to the builder
+Parameters: token_cursor &c: cursor positioned on the next spellbook
+			const char* base: start of the mapped file, which becomes the catalog's string pool
+			catalog_builder &b: builder the spellbook is appended to
+Returns: a boolean value, true if a complete spellbook was read
+*/
+bool read_mapped_spellbook(token_cursor &c, const char* base, catalog_builder &b) {
+	spellbook_record r;
+	if (not read_record<spellbook_schema>(c, r) || r.num_spells < 0)
+		return false;
+	spellbook sb;
+	sb.title = {(std::uint64_t)(r.title.data() - base), (std::uint32_t)r.title.size()};
+	sb.author = intern_string(b.authors, r.author);
+	sb.num_pages = r.num_pages;
+	sb.edition = r.edition;
+
+	sb.spell_begin = b.names.size();
+	for (int i = 0; i < r.num_spells; i++) {
+		if (not read_mapped_spell(c, base, b))
+			return false;
+	}
+	sb.spell_end = b.names.size();
+
+	sb.avg_success_rate = 0; // filled in by finish_catalog
+	b.spellbooks.push_back(sb);
+	return true;
+}
+
+/*
+Function: skip_tokens
+Description: moves the cursor past the next n tokens without converting them
+Parameters: token_cursor &c: cursor into the mapped file
+			long long n: number of tokens to skip
+Returns: a boolean value, true if all n tokens were there
+*/
+bool skip_tokens(token_cursor &c, long long n) {
+	for (long long i = 0; i < n; i++) {
+		if (next_token(c).empty())
+			return false;
+	}
+	return true;
+}
+
+/*
+Function: find_spellbook_bounds
+Description: first pass of the parallel loader. finds where every spellbook record starts by reading
+	only each header's num_spells and skipping the spell tokens after it
+Parameters: token_cursor c: cursor positioned on the first spellbook
+			int num_spellbooks: number of spellbooks the file declares
+			std::vector<const char*> &starts: filled with num_spellbooks + 1 positions, the last one is
+				the end of the final record
+Returns: a boolean value, true if every record was found
+*/
+bool find_spellbook_bounds(token_cursor c, int num_spellbooks, std::vector<const char*> &starts) {
+	starts.clear();
+	starts.reserve(num_spellbooks + 1);
+	for (int i = 0; i < num_spellbooks; i++) {
+		starts.push_back(c.pos);
+		int num_spells;
+		if (not skip_tokens(c, 4) || not next_int(c, num_spells) || num_spells < 0 ||
+				not skip_tokens(c, 3LL * num_spells))
+			return false;
+	}
+	starts.push_back(c.pos);
+	return true;
+}
+
+/*
+Function: read_mapped_spellbooks_parallel
+Description: parallel counterpart of the read_mapped_spellbook loop. after find_spellbook_bounds, the
+	records are cut into chunks of roughly equal bytes which a pool of threads parses into one builder
+	per chunk, so finish_catalog can merge them back in file order
+Parameters: token_cursor c: cursor positioned on the first spellbook
+			const char* base: start of the mapped file, which becomes the catalog's string pool
+			int num_spellbooks: number of spellbooks the file declares
+			int num_threads: number of parsing threads
+			std::vector<catalog_builder> &parts: filled with one builder per chunk, in file order
+Returns: a boolean value, true if every spellbook parsed
+*/
+bool read_mapped_spellbooks_parallel(token_cursor c, const char* base, int num_spellbooks, int num_threads,
+									std::vector<catalog_builder> &parts) {
+	std::vector<const char*> starts;
+	if (not find_spellbook_bounds(c, num_spellbooks, starts))
+		return false;
+
+	//a few chunks per thread so one slow chunk doesn't leave the others idle
+	int num_chunks = std::max(1, std::min(num_spellbooks, num_threads * 4));
+	std::vector<int> chunk_first(num_chunks + 1, num_spellbooks);
+	chunk_first[0] = 0;
+	std::size_t total_bytes = starts.back() - starts.front();
+	for (int k = 1, book = 0; k < num_chunks; k++) {
+		const char* target = starts.front() + total_bytes * k / num_chunks;
+		while (book < num_spellbooks && starts[book] < target)
+			book++;
+		chunk_first[k] = std::max(book, chunk_first[k - 1]);
+	}
+
+	parts.clear();
+	parts.resize(num_chunks);
+	std::vector<char> chunk_ok(num_chunks, 1);
+	std::atomic<int> next_chunk(0);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < num_threads; t++) {
+		workers.emplace_back([&]() {
+			for (int k = next_chunk++; k < num_chunks; k = next_chunk++) {
+				catalog_builder &b = parts[k];
+				b.effects = create_effect_table();
+				token_cursor chunk = {starts[chunk_first[k]], starts[chunk_first[k + 1]]};
+				for (int i = chunk_first[k]; i < chunk_first[k + 1] && chunk_ok[k]; i++)
+					chunk_ok[k] = read_mapped_spellbook(chunk, base, b);
+			}
+		});
+	}
+	for (std::thread &w : workers) w.join();
+
+	return std::find(chunk_ok.begin(), chunk_ok.end(), 0) == chunk_ok.end();
+}
+
+/*
+Function: record_hash
+Description: 64-bit FNV-1a hash of a spellbook's text record, how a reload recognises records it has
+	already parsed
+Parameters: const char* begin, const char* end: the record's bytes
+Returns: the hash
+*/
+std::uint64_t record_hash(const char* begin, const char* end) {
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (const char* p = begin; p < end; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+Function: hash_spellbook_records
+Description: finds and hashes every spellbook record of a text spellbook file, so the next reload can
+	reuse the spellbooks whose records didn't change
+Parameters: catalog_version &v: version loaded from the text file in v.spellbook_map, its record_starts
+				and record_hashes are filled (and left empty if the file is malformed)
+Returns: a boolean value, true if every record was found
+*/
+bool hash_spellbook_records(catalog_version &v) {
+	token_cursor c = {v.spellbook_map.data, v.spellbook_map.data + v.spellbook_map.size};
+	int num_spellbooks;
+	if (not next_int(c, num_spellbooks) || num_spellbooks < 0 ||
+			not find_spellbook_bounds(c, num_spellbooks, v.record_starts)) {
+		v.record_starts.clear();
+		return false;
+	}
+
+	v.record_hashes.resize(num_spellbooks);
+	for (int i = 0; i < num_spellbooks; i++) {
+		v.record_hashes[i] = record_hash(v.record_starts[i], v.record_starts[i + 1]);
+	}
+	return true;
+}
+
+/*
+Function: remap_id
+Description: gives an id interned in an older version's table its id in a new table, interning the string
+	there the first time it is asked for
+Parameters: std::vector<int> &remapped: old id -> new id, -1 until known, sized to the old table
+			const intern_table &from: the old table
+			int id: id in from
+			intern_table &to: the new table
+Returns: the id of the same string in to
+*/
+int remap_id(std::vector<int> &remapped, const intern_table &from, int id, intern_table &to) {
+	if (remapped[id] == -1)
+		remapped[id] = intern_string(to, from.names[id]);
+	return remapped[id];
+}
+
+/*
+Function: reuse_spellbook
+Description: appends a spellbook of an older version to a builder without parsing it again. its record
+	is byte for byte the same in the new file, so its strings sit at the same place relative to the
+	record and only their offsets move. its effect and author ids are interned again in the builder's
+	tables, so names that left the file don't carry over
+Parameters: const catalog_version &old: version the spellbook was parsed in
+			int book: index of the spellbook in old
+			std::uint64_t new_start: offset of the same record in the new file
+			catalog_builder &b: builder the spellbook is appended to
+			std::vector<int> &effect_ids: old effect id -> id in b, see remap_id
+			std::vector<int> &author_ids: old author id -> id in b, see remap_id
+*/
+void reuse_spellbook(const catalog_version &old, int book, std::uint64_t new_start, catalog_builder &b,
+					std::vector<int> &effect_ids, std::vector<int> &author_ids) {
+	const catalog &cat = old.cat;
+	std::uint64_t old_start = old.record_starts[book] - old.spellbook_map.data;
+	auto moved = [old_start, new_start](pool_string ps) {
+		return pool_string{ps.offset - old_start + new_start, ps.length};
+	};
+
+	spellbook sb = cat.spellbooks[book];
+	sb.title = moved(sb.title);
+	sb.author = remap_id(author_ids, cat.authors, sb.author, b.authors);
+	int spell_begin = b.names.size();
+	for (int i = sb.spell_begin; i < sb.spell_end; i++) {
+		b.names.push_back(moved(cat.names[i]));
+		b.success_rates.push_back(cat.success_rates[i]);
+		b.effect_ids.push_back(remap_id(effect_ids, cat.effects, cat.effect_ids[i], b.effects));
+	}
+	sb.spell_begin = spell_begin;
+	sb.spell_end = b.names.size();
+	b.spellbooks.push_back(sb);
+}
+
+/*
+Function: read_mapped_wizard
+Description: mapped counterpart of read_wizard_data
+Parameters: token_cursor &c: cursor positioned on the next wizard
+			wizard &w: filled with the wizard's fields
+Returns: a boolean value, true if a complete wizard was read
+*/
+bool read_mapped_wizard(token_cursor &c, wizard &w) {
+	wizard_record r;
+	if (not read_record<wizard_schema>(c, r))
+		return false;
+	w = make_wizard(r);
+	return true;
+}
+
+/*
+Function: write_snapshot
+Description: saves a catalog version as a binary snapshot: a header with the offsets of every section, the
+	spell columns exactly as they sit in memory, a compacted string pool holding only the titles,
+	authors, spell names and effects (so a catalog mapped from a text file doesn't drag the whole text
+	file along), and the title order, effect postings and role aggregates, which take longer to rebuild
+	than to read. open_snapshot can later use the file directly without parsing it
+Parameters: const catalog_version &v: the version to save
+			const std::string &filename: name of the snapshot file to write
+Returns: a boolean value, true if the whole snapshot was written
+*/
+bool write_snapshot(const catalog_version &v, const std::string &filename) {
+	const catalog &cat = v.cat;
+	//copy the strings into a fresh pool, each distinct string once, field by field so padding bytes are
+	//written as zeros
+	std::string pool;
+	std::unordered_map<std::string_view, pool_string> pooled;
+	auto compact = [&](std::string_view str) {
+		std::unordered_map<std::string_view, pool_string>::const_iterator it = pooled.find(str);
+		if (it != pooled.end())
+			return it->second;
+		pool_string ps = {};
+		ps.offset = pool.size();
+		ps.length = str.size();
+		pool.append(str);
+		pooled.emplace(str, ps);
+		return ps;
+	};
+	std::vector<spellbook> books(cat.num_spellbooks);
+	for (int i = 0; i < cat.num_spellbooks; i++) {
+		const spellbook &sb = cat.spellbooks[i];
+		books[i].title = compact(pool_view(cat, sb.title));
+		books[i].author = sb.author;
+		books[i].num_pages = sb.num_pages;
+		books[i].edition = sb.edition;
+		books[i].spell_begin = sb.spell_begin;
+		books[i].spell_end = sb.spell_end;
+		books[i].avg_success_rate = sb.avg_success_rate;
+	}
+	std::vector<pool_string> names(cat.num_spells);
+	for (int i = 0; i < cat.num_spells; i++)
+		names[i] = compact(pool_view(cat, cat.names[i]));
+	std::vector<pool_string> effect_names(cat.effects.names.size());
+	for (std::size_t e = 0; e < effect_names.size(); e++)
+		effect_names[e] = compact(cat.effects.names[e]);
+	std::vector<pool_string> author_names(cat.authors.names.size());
+	for (std::size_t a = 0; a < author_names.size(); a++)
+		author_names[a] = compact(cat.authors.names[a]);
+
+	//every role's rows one after the other, copied field by field for the same reason
+	const std::vector<int> &editions = v.views[0].aggregates.editions;
+	std::vector<rate_aggregate> aggregates;
+	auto append_rows = [&aggregates](const std::vector<rate_aggregate> &rows) {
+		for (const rate_aggregate &row : rows) {
+			rate_aggregate copy;
+			std::memset(&copy, 0, sizeof(copy));
+			copy.count = row.count;
+			copy.sum = row.sum;
+			copy.min = row.min;
+			copy.max = row.max;
+			std::copy(row.histogram, row.histogram + NUM_RATE_BUCKETS, copy.histogram);
+			aggregates.push_back(copy);
+		}
+	};
+	for (const role_view &view : v.views) {
+		append_rows(view.aggregates.by_effect);
+		append_rows(view.aggregates.by_author);
+		append_rows(view.aggregates.by_edition);
+	}
+
+	const char* data[NUM_SNAPSHOT_SECTIONS] = {
+		reinterpret_cast<const char*>(books.data()), reinterpret_cast<const char*>(cat.success_rates),
+		reinterpret_cast<const char*>(cat.effect_ids), reinterpret_cast<const char*>(names.data()),
+		reinterpret_cast<const char*>(effect_names.data()), reinterpret_cast<const char*>(author_names.data()),
+		pool.data(), reinterpret_cast<const char*>(v.titles.sorted.data()),
+		reinterpret_cast<const char*>(v.effects.offsets.data()), reinterpret_cast<const char*>(v.effects.postings.data()),
+		reinterpret_cast<const char*>(editions.data()), reinterpret_cast<const char*>(aggregates.data())};
+
+	snapshot_header header = {};
+	std::copy(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8, header.magic);
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = 0x01020304;
+	header.spellbook_size = sizeof(spellbook);
+	header.num_spellbooks = cat.num_spellbooks;
+	header.num_spells = cat.num_spells;
+	header.num_effects = effect_names.size();
+	header.num_authors = author_names.size();
+	header.num_editions = editions.size();
+	header.num_roles = v.views.size();
+	header.section_size[SECTION_SPELLBOOKS] = books.size() * sizeof(spellbook);
+	header.section_size[SECTION_SUCCESS_RATES] = cat.num_spells * sizeof(float);
+	header.section_size[SECTION_EFFECT_IDS] = cat.num_spells * sizeof(int);
+	header.section_size[SECTION_NAMES] = names.size() * sizeof(pool_string);
+	header.section_size[SECTION_EFFECT_NAMES] = effect_names.size() * sizeof(pool_string);
+	header.section_size[SECTION_AUTHOR_NAMES] = author_names.size() * sizeof(pool_string);
+	header.section_size[SECTION_POOL] = pool.size();
+	header.section_size[SECTION_TITLE_ORDER] = v.titles.sorted.size() * sizeof(int);
+	header.section_size[SECTION_EFFECT_OFFSETS] = v.effects.offsets.size() * sizeof(int);
+	header.section_size[SECTION_EFFECT_POSTINGS] = v.effects.postings.size() * sizeof(effect_posting);
+	header.section_size[SECTION_EDITIONS] = editions.size() * sizeof(int);
+	header.section_size[SECTION_AGGREGATES] = aggregates.size() * sizeof(rate_aggregate);
+	std::size_t cursor = sizeof(snapshot_header);
+	for (int k = 0; k < NUM_SNAPSHOT_SECTIONS; k++)
+		header.section_offset[k] = arena_column(cursor, header.section_size[k]);
+
+	std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::uint64_t written = sizeof(header);
+	const char zeros[64] = {};
+	for (int k = 0; k < NUM_SNAPSHOT_SECTIONS; k++) {
+		out.write(zeros, header.section_offset[k] - written);
+		out.write(data[k], header.section_size[k]);
+		written = header.section_offset[k] + header.section_size[k];
+	}
+	out.close();
+	return not out.fail();
+}
+
+/*
+Function: is_snapshot
+Description: checks whether a mapped file starts like a catalog snapshot rather than a text file
+Parameters: const mapped_file &map: the mapped file
+Returns: true if the file begins with the snapshot magic
+*/
+bool is_snapshot(const mapped_file &map) {
+	return map.size >= sizeof(SNAPSHOT_MAGIC) && std::equal(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 8, map.data);
+}
+
+/*
+Function: snapshot_section_data
+Description: finds a section of a snapshot whose bounds have been checked
+Parameters: const mapped_file &map: the mapped snapshot file
+			const snapshot_header &header: its header
+			snapshot_section k: the section
+Returns: the section's first element
+*/
+template <typename element>
+const element* snapshot_section_data(const mapped_file &map, const snapshot_header &header, snapshot_section k) {
+	return reinterpret_cast<const element*>(map.data + header.section_offset[k]);
+}
+
+/*
+Function: snapshot_indexes_valid
+Description: index half of snapshot_records_valid, run once the records are known to be in range: the
+	title order must list spellbooks sorted by title (equal titles in catalog order), the effect postings
+	must be grouped by effect and point at spells with that effect, and the editions must be ascending
+Parameters: const mapped_file &map: the mapped snapshot file
+			const snapshot_header &header: its header
+Returns: a boolean value, true if every index entry is in range and in order
+*/
+bool snapshot_indexes_valid(const mapped_file &map, const snapshot_header &header) {
+	const spellbook* books = snapshot_section_data<spellbook>(map, header, SECTION_SPELLBOOKS);
+	const char* pool = map.data + header.section_offset[SECTION_POOL];
+	auto title_of = [books, pool](int book) {
+		return std::string_view(pool + books[book].title.offset, books[book].title.length);
+	};
+	const int* sorted = snapshot_section_data<int>(map, header, SECTION_TITLE_ORDER);
+	for (int i = 0; i < header.num_spellbooks; i++) {
+		if (sorted[i] < 0 || sorted[i] >= header.num_spellbooks)
+			return false;
+		if (i > 0) {
+			int order = title_of(sorted[i - 1]).compare(title_of(sorted[i]));
+			if (order > 0 || (order == 0 && sorted[i - 1] >= sorted[i]))
+				return false;
+		}
+	}
+
+	const int* effect_ids = snapshot_section_data<int>(map, header, SECTION_EFFECT_IDS);
+	const int* offsets = snapshot_section_data<int>(map, header, SECTION_EFFECT_OFFSETS);
+	const effect_posting* postings = snapshot_section_data<effect_posting>(map, header, SECTION_EFFECT_POSTINGS);
+	if (offsets[0] != 0 || offsets[header.num_effects] != header.num_spells)
+		return false;
+	for (int e = 0; e < header.num_effects; e++) {
+		if (offsets[e + 1] < offsets[e] || offsets[e + 1] > header.num_spells)
+			return false;
+		for (int p = offsets[e]; p < offsets[e + 1]; p++) {
+			const effect_posting &hit = postings[p];
+			if (hit.book < 0 || hit.book >= header.num_spellbooks || hit.spell < books[hit.book].spell_begin ||
+					hit.spell >= books[hit.book].spell_end || effect_ids[hit.spell] != e)
+				return false;
+		}
+	}
+
+	const int* editions = snapshot_section_data<int>(map, header, SECTION_EDITIONS);
+	for (int i = 1; i < header.num_editions; i++) {
+		if (editions[i - 1] >= editions[i])
+			return false;
+	}
+	return true;
+}
+
+/*
+Function: snapshot_records_valid
+Description: checks every record of a snapshot whose header and section bounds have been checked, so a
+	damaged snapshot is refused instead of sending the queries out of bounds: ids must name an effect or
+	author, spell ranges must lie inside the spells and follow each other in order, every string must
+	fit inside the pool, and the stored indexes must agree with the records (see snapshot_indexes_valid)
+Parameters: const mapped_file &map: the mapped snapshot file
+			const snapshot_header &header: its header
+Returns: a boolean value, true if every record is in range
+*/
+bool snapshot_records_valid(const mapped_file &map, const snapshot_header &header) {
+	std::uint64_t pool_size = header.section_size[SECTION_POOL];
+	auto in_pool = [pool_size](const pool_string &ps) {
+		return ps.offset <= pool_size && ps.length <= pool_size - ps.offset;
+	};
+	auto strings_in_pool = [&map, &header, &in_pool](snapshot_section k, int count) {
+		const pool_string* strings = reinterpret_cast<const pool_string*>(map.data + header.section_offset[k]);
+		return std::all_of(strings, strings + count, in_pool);
+	};
+
+	const spellbook* books = reinterpret_cast<const spellbook*>(map.data + header.section_offset[SECTION_SPELLBOOKS]);
+	int previous_end = 0;
+	for (int i = 0; i < header.num_spellbooks; i++) {
+		const spellbook &sb = books[i];
+		if (not in_pool(sb.title) || sb.author < 0 || sb.author >= header.num_authors ||
+				sb.spell_begin < previous_end || sb.spell_begin > sb.spell_end || sb.spell_end > header.num_spells)
+			return false;
+		previous_end = sb.spell_end;
+	}
+
+	const int* effect_ids = reinterpret_cast<const int*>(map.data + header.section_offset[SECTION_EFFECT_IDS]);
+	for (int i = 0; i < header.num_spells; i++) {
+		if (effect_ids[i] < 0 || effect_ids[i] >= header.num_effects)
+			return false;
+	}
+	return strings_in_pool(SECTION_NAMES, header.num_spells) &&
+		strings_in_pool(SECTION_EFFECT_NAMES, header.num_effects) &&
+		strings_in_pool(SECTION_AUTHOR_NAMES, header.num_authors) && snapshot_indexes_valid(map, header);
+}
+
+/*
+Function: open_snapshot
+Description: uses a mapped snapshot written by write_snapshot as the catalog. the columns point straight
+	into the mapping (so the mapping has to outlive the catalog) and only the small effect table is
+	rebuilt. the header, section bounds, every record and the stored indexes are checked (see
+	snapshot_records_valid), the indexes are read later by read_snapshot_indexes
+Parameters: const mapped_file &map: the mapped snapshot file
+			catalog &cat: pointed at the snapshot's sections
+Returns: a boolean value, true if the snapshot matches this program's version and layout
+*/
+bool open_snapshot(const mapped_file &map, catalog &cat) {
+	if (map.size < sizeof(snapshot_header) || not is_snapshot(map))
+		return false;
+
+	snapshot_header header;
+	std::copy(map.data, map.data + sizeof(header), reinterpret_cast<char*>(&header));
+	if (header.version != SNAPSHOT_VERSION || header.byte_order != 0x01020304 ||
+			header.spellbook_size != sizeof(spellbook) || header.num_spellbooks < 0 || header.num_spells < 0 ||
+			header.num_effects < NUM_KNOWN_EFFECTS || header.num_authors < 0 || header.num_editions < 0 ||
+			header.num_roles != NUM_ROLES)
+		return false;
+
+	std::uint64_t rows_per_role = (std::uint64_t)header.num_effects + header.num_authors + header.num_editions;
+	std::uint64_t expected[NUM_SNAPSHOT_SECTIONS] = {
+		header.num_spellbooks * sizeof(spellbook), header.num_spells * sizeof(float),
+		header.num_spells * sizeof(int), header.num_spells * sizeof(pool_string),
+		header.num_effects * sizeof(pool_string), header.num_authors * sizeof(pool_string),
+		header.section_size[SECTION_POOL], header.num_spellbooks * sizeof(int),
+		(header.num_effects + 1) * sizeof(int), header.num_spells * sizeof(effect_posting),
+		header.num_editions * sizeof(int), NUM_ROLES * rows_per_role * sizeof(rate_aggregate)};
+	for (int k = 0; k < NUM_SNAPSHOT_SECTIONS; k++) {
+		if (header.section_size[k] != expected[k] || header.section_offset[k] % 64 != 0 ||
+				header.section_offset[k] > map.size || header.section_size[k] > map.size - header.section_offset[k])
+			return false;
+	}
+	if (not snapshot_records_valid(map, header))
+		return false;
+
+	cat.num_spellbooks = header.num_spellbooks;
+	cat.num_spells = header.num_spells;
+	cat.spellbooks = reinterpret_cast<const spellbook*>(map.data + header.section_offset[SECTION_SPELLBOOKS]);
+	cat.success_rates = reinterpret_cast<const float*>(map.data + header.section_offset[SECTION_SUCCESS_RATES]);
+	cat.effect_ids = reinterpret_cast<const int*>(map.data + header.section_offset[SECTION_EFFECT_IDS]);
+	cat.names = reinterpret_cast<const pool_string*>(map.data + header.section_offset[SECTION_NAMES]);
+	cat.pool = map.data + header.section_offset[SECTION_POOL];
+	cat.arena = nullptr;
+
+	//effect and author ids in the snapshot are the ids they were interned with, so intern them in the same order
+	const pool_string* effect_names =
+		reinterpret_cast<const pool_string*>(map.data + header.section_offset[SECTION_EFFECT_NAMES]);
+	cat.effects = create_effect_table();
+	for (int e = 0; e < header.num_effects; e++) {
+		if (intern_string(cat.effects, pool_view(cat, effect_names[e])) != e)
+			return false;
+	}
+	const pool_string* author_names =
+		reinterpret_cast<const pool_string*>(map.data + header.section_offset[SECTION_AUTHOR_NAMES]);
+	cat.authors = intern_table();
+	for (int a = 0; a < header.num_authors; a++) {
+		if (intern_string(cat.authors, pool_view(cat, author_names[a])) != a)
+			return false;
+	}
+	return true;
+}
+
+/*
+Function: read_mapped_wizards
+Description: wizard half of read_in_mapped_data
+Parameters: const mapped_file &wizard_map: mapping of the user given wizard file
+			wizard*& wizards: pointer to the created wizards object
+			int& num_wizards: number of wizards read
+Returns: a boolean value, true if the file parsed completely
+*/
+bool read_mapped_wizards(const mapped_file &wizard_map, wizard*& wizards, int& num_wizards) {
+	token_cursor c = {wizard_map.data, wizard_map.data + wizard_map.size};
+	if (not next_int(c, num_wizards) || num_wizards < 0) {
+		num_wizards = 0;
+		std::cout << "Error: malformed wizard file." << std::endl;
+		return false;
+	}
+	wizards = create_wizards(num_wizards);
+	for (int i = 0; i < num_wizards; i++) {
+		if (not read_mapped_wizard(c, wizards[i])) {
+			std::cout << "Error: malformed wizard file." << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+Function: read_mapped_spellbooks
+Description: spellbook half of read_in_mapped_data. a snapshot is used as is, a text file is parsed on a
+	thread per core when it is big enough to be worth it
+Parameters: const mapped_file &spellbook_map: mapping (or copy) of the spellbook file
+			catalog &cat: filled with the spellbooks and spells
+Returns: a boolean value, true if the file parsed completely
+*/
+bool read_mapped_spellbooks(const mapped_file &spellbook_map, catalog &cat) {
+	if (is_snapshot(spellbook_map)) {
+		if (not open_snapshot(spellbook_map, cat)) {
+			std::cout << "Error: snapshot is damaged or was made by a different version of this program." << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	//big files are split over a thread per core, small ones aren't worth the extra pass
+	token_cursor c = {spellbook_map.data, spellbook_map.data + spellbook_map.size};
+	std::vector<catalog_builder> parts(1);
+	int num_spellbooks;
+	int num_threads = std::thread::hardware_concurrency();
+	bool ok = next_int(c, num_spellbooks) && num_spellbooks >= 0;
+	if (ok && num_threads > 1 && spellbook_map.size >= PARALLEL_PARSE_THRESHOLD) {
+		ok = read_mapped_spellbooks_parallel(c, spellbook_map.data, num_spellbooks, num_threads, parts);
+	} else {
+		parts[0].effects = create_effect_table();
+		for (int i = 0; ok && i < num_spellbooks; i++) {
+			ok = read_mapped_spellbook(c, spellbook_map.data, parts[0]);
+		}
+	}
+	if (not ok) {
+		std::cout << "Error: malformed spellbook file." << std::endl;
+		return false;
+	}
+	finish_catalog(parts, spellbook_map.data, cat);
+	return true;
+}
+
+/*
+Function: read_in_mapped_data
+Description: zero-copy alternative to read_in_data, parses both mapped files with the hand-written
+	tokenizer. the catalog's string pool is the spellbook mapping itself, so the mapping has to stay
+	alive until the catalog is released. a spellbook file that is a snapshot is used as is
+Parameters: const mapped_file &wizard_map: mapping of the user given wizard file
+			const mapped_file &spellbook_map: mapping of the user given spellbook file
+			wizard*& wizards: pointer to the created wizards object
+			int& num_wizards: number of wizards read
+			catalog &cat: filled with the spellbooks and spells
+Returns: a boolean value, true if both files parsed completely, false if either is malformed
+*/
+bool read_in_mapped_data(const mapped_file &wizard_map, const mapped_file &spellbook_map, wizard*& wizards,
+						int& num_wizards, catalog &cat) {
+	return read_mapped_wizards(wizard_map, wizards, num_wizards) && read_mapped_spellbooks(spellbook_map, cat);
+}
+
+/*
+Function: read_in_data
+Description: reads in spellbook and wizards data from the user given files, creating the wizards dynamic
+	array and the spellbook catalog. 
+Parameters: std::ifstream& wizard_in: reference to the user given wizard file
+			std::ifstream& spellbook_in: reference to the user given spellbook file 
+			wizard*& wizards: pointer to the created wizards object
+			int& num_wizards: integer found in the beginning of the file with the number of wizards 
+			catalog &cat: filled with the spellbooks and spells, its arena owns a copy of every string
+Returns: a boolean value depending on if the reading was a success
+*/
+bool read_in_data(std::ifstream& wizard_in, std::ifstream& spellbook_in, wizard*& wizards, 
+					int& num_wizards, catalog &cat){
+	wizard_in >> num_wizards;
+	wizards = create_wizards(num_wizards);
+	for (int i = 0; i < num_wizards; i++) {
+		wizards[i] = read_wizard_data(wizard_in);
+	}
+
+	int num_spellbooks = 0;
+	std::vector<catalog_builder> parts(1);
+	parts[0].effects = create_effect_table();
+	spellbook_in >> num_spellbooks; 
+	for (int i = 0; i < num_spellbooks; i++) {
+		read_spellbook_data(spellbook_in, parts[0]);
+	}
+	finish_catalog(parts, nullptr, cat);
+	return true;
+}
+
+/*
+Function: user_login
+Description: takes the uder given ID and password, sends them to login_verification() to find a match, and 
+	prints the information of the logged in user to the terminal
+Parameters: const wizard* wizards: pointer for the wizards dynamic array
+			int num_wizards: read in from the first line of the user given wizards file
+			const login_index &index: id index over the wizards array
+			const wizard*& current_user: set to point at the wizard currently logged in
+*/
+bool user_login(const wizard* wizards, int num_wizards, const login_index &index, const wizard*& current_user) {
+    int login_attempts = 0;
+    bool logged_in = false;
+    
+	//let the user try to login three times
+    while (not logged_in && login_attempts < 3) {
+        int id;
+        std::string password;
+        std::cout << "Please enter your ID: ";
+        std::cin >> id;
+        std::cout << "Please enter your password: ";
+        std::cin >> password;
+        
+		//if verification succeeds, print info to terminal
+        login_result result = login_verification(wizards, num_wizards, index, id, password, current_user);
+        if (result == LOGIN_OK) {
+            logged_in = true;
+            std::cout << "Welcome, " << current_user->name << "!" << std::endl;
+        	std::cout << "ID: " << current_user->id  << std::endl;
+            std::cout << "Status: " << current_user->position_title << std::endl;
+            std::cout << "Beard Length: " << current_user->beard_length << std::endl;
+			return true;
+		} else {
+			//let the user try to login again if verification returns false
+            login_attempts++;
+            count_event(COUNTER_FAILED_LOGINS);
+			if (result == LOGIN_THROTTLED) {
+				count_event(COUNTER_THROTTLED_LOGINS);
+				std::cout << "Too many failed logins for that id, try again later." << std::endl;
+			} else {
+				std::cout << "Incorrect id or password. Attempts remaining: " << login_attempts << std::endl;
+			}
+        }
+    }
+	//end program when theres more than three attempts
+	std::cout << "Too many failed login attempts." << std::endl;
+	return false;
+}
+
+/*
+Function: rank_before
+Description: ordering used by the ranking engine, descending success rate with ties kept in catalog
+	order (which is what the old bubble sort produced, since it only swapped on a strict <)
+Parameters: const rank_key &a: left hand key
+			const rank_key &b: right hand key
+Returns: true if a should be listed before b
+*/
+bool rank_before(const rank_key &a, const rank_key &b) {
+	if (a.success_rate != b.success_rate)
+		return a.success_rate > b.success_rate;
+	return a.spell < b.spell;
+}
+
+/*
+Function: collect_rank_keys
+Description: builds one rank_key per spell the user is allowed to see from their role's list of visible
+	spells, so only the success rate column is read
+Parameters: const catalog &cat: the loaded catalog
+			const role_view &view: the logged-in user's view of cat
+			std::vector<rank_key> &keys: filled with the keys, in catalog order
+*/
+void collect_rank_keys(const catalog &cat, const role_view &view, std::vector<rank_key> &keys) {
+	keys.resize(view.spells.size());
+	for (std::size_t k = 0; k < view.spells.size(); k++) {
+		int i = view.spells[k];
+		keys[k] = {cat.success_rates[i], i};
+	}
+}
+
+/*
+Function: parallel_sort_keys
+Description: sorts the keys by splitting them into one run per thread, sorting the runs
+	concurrently and then merging neighbouring runs pairwise (also concurrently) until one is left
+Parameters: std::vector<rank_key> &keys: keys to sort in place
+			int num_threads: number of runs to split the keys into
+*/
+void parallel_sort_keys(std::vector<rank_key> &keys, int num_threads) {
+	int n = keys.size();
+	std::vector<int> bounds;
+	for (int t = 0; t <= num_threads; t++) {
+		bounds.push_back((long long)n * t / num_threads);
+	}
+
+	std::vector<std::thread> workers;
+	for (int t = 0; t < num_threads; t++) {
+		workers.emplace_back([&keys, &bounds, t]() {
+			std::sort(keys.begin() + bounds[t], keys.begin() + bounds[t + 1], rank_before);
+		});
+	}
+	for (std::thread &w : workers) w.join();
+
+	//merge runs pairwise: (0,1) (2,3) ... then (0-1,2-3) ... until one run is left
+	for (int width = 1; width < num_threads; width *= 2) {
+		workers.clear();
+		for (int t = 0; t + width < num_threads; t += 2 * width) {
+			int first = bounds[t];
+			int middle = bounds[t + width];
+			int last = bounds[std::min(t + 2 * width, num_threads)];
+			workers.emplace_back([&keys, first, middle, last]() {
+				std::inplace_merge(keys.begin() + first, keys.begin() + middle, keys.begin() + last, rank_before);
+			});
+		}
+		for (std::thread &w : workers) w.join();
+	}
+}
+
+/*
+Function: rank_spells
+Description: ranking engine for spells. with top_k > 0 only the best top_k keys are selected (partial
+	selection, O(n log k)) and moved to the front in order, otherwise every key is sorted, on several
+	threads when parallel is set and there are enough keys for it to pay off
+Parameters: std::vector<rank_key> &keys: keys to rank, resized to the ranked count on return
+			int top_k: number of best spells wanted, 0 for all of them
+			bool parallel: true to allow a multi-threaded full sort
+*/
+void rank_spells(std::vector<rank_key> &keys, int top_k, bool parallel) {
+	if (top_k > 0 && top_k < (int)keys.size()) {
+		std::partial_sort(keys.begin(), keys.begin() + top_k, keys.end(), rank_before);
+		keys.resize(top_k);
+		return;
+	}
+
+	int num_threads = std::thread::hardware_concurrency();
+	if (parallel && num_threads > 1 && (int)keys.size() >= PARALLEL_SORT_THRESHOLD) {
+		parallel_sort_keys(keys, num_threads);
+	} else {
+		std::sort(keys.begin(), keys.end(), rank_before);
+	}
+}
+
+/*
+Function: rate_order
+Description: every spell of a version in ranking order, for the query engine's success_rate ranges. built
+	the first time a query needs it rather than at publish time, since only range queries pay for it
+Parameters: const catalog_version &v: the published version
+Returns: v.by_rate, built if this is its first use
+*/
+const std::vector<rank_key>& rate_order(const catalog_version &v) {
+	std::call_once(v.rate_order_built, [&v]() {
+		v.by_rate.resize(v.cat.num_spells);
+		for (int i = 0; i < v.cat.num_spells; i++)
+			v.by_rate[i] = {v.cat.success_rates[i], i};
+		rank_spells(v.by_rate, 0, true);
+	});
+	return v.by_rate;
+}
+
+/*
+Function: delete_catalog_version
+Description: deleter of a catalog_version's shared_ptr, runs once the last query holding the version is done
+Parameters: const catalog_version* v: the version to delete
+*/
+void delete_catalog_version(const catalog_version* v) {
+	catalog_version* owned = const_cast<catalog_version*>(v);
+	release_catalog(owned->cat);
+	unmap_file(owned->spellbook_map);
+	delete owned;
+}
+
+/*
+Function: read_snapshot_indexes
+Description: fills a version opened from a snapshot with the title order, effect postings and role
+	aggregates stored in it, already checked by open_snapshot. only the role masks are rebuilt
+Parameters: catalog_version &v: the version, whose spellbook_map is the snapshot
+*/
+void read_snapshot_indexes(catalog_version &v) {
+	const mapped_file &map = v.spellbook_map;
+	snapshot_header header;
+	std::copy(map.data, map.data + sizeof(header), reinterpret_cast<char*>(&header));
+
+	const int* sorted = snapshot_section_data<int>(map, header, SECTION_TITLE_ORDER);
+	v.titles.sorted.assign(sorted, sorted + header.num_spellbooks);
+	const int* offsets = snapshot_section_data<int>(map, header, SECTION_EFFECT_OFFSETS);
+	v.effects.offsets.assign(offsets, offsets + header.num_effects + 1);
+	const effect_posting* postings = snapshot_section_data<effect_posting>(map, header, SECTION_EFFECT_POSTINGS);
+	v.effects.postings.assign(postings, postings + header.num_spells);
+
+	build_role_masks(v.cat, v.views);
+	const int* editions = snapshot_section_data<int>(map, header, SECTION_EDITIONS);
+	const rate_aggregate* rows = snapshot_section_data<rate_aggregate>(map, header, SECTION_AGGREGATES);
+	for (role_view &view : v.views) {
+		aggregate_tables &tables = view.aggregates;
+		tables.by_effect.assign(rows, rows + header.num_effects);
+		rows += header.num_effects;
+		tables.by_author.assign(rows, rows + header.num_authors);
+		rows += header.num_authors;
+		tables.by_edition.assign(rows, rows + header.num_editions);
+		rows += header.num_editions;
+		tables.editions.assign(editions, editions + header.num_editions);
+		tables.edition_rows.clear();
+		for (int e = 0; e < header.num_editions; e++)
+			tables.edition_rows.emplace(editions[e], e);
+	}
+}
+
+/*
+Function: publish_version
+Description: builds the effect and title indexes and role views of a freshly loaded version (or reads them
+	from its snapshot) and hands it to a shared_ptr, after which it is read-only
+Parameters: catalog_version* v: the loaded version, owned by the returned pointer
+Returns: the shared version, ready to be stored in library::spellbooks
+*/
+std::shared_ptr<const catalog_version> publish_version(catalog_version* v) {
+	if (is_snapshot(v->spellbook_map)) {
+		read_snapshot_indexes(*v);
+	} else {
+		build_effect_index(v->cat, v->effects);
+		build_title_index(v->cat, v->titles);
+		build_role_views(v->cat, v->views);
+	}
+	return std::shared_ptr<const catalog_version>(v, delete_catalog_version);
+}
+
+/*
+Function: load_library
+Description: reads the user given wizard and spellbook files (through memory mappings when possible,
+	falling back to the streams e.g. for pipes) and builds the login, effect and title indexes. when
+	lib.watching is set the spellbook file is copied instead of mapped and its records are hashed, so
+	reload_spellbooks can later reuse them
+Parameters: const std::string &wizard_file: user given wizard info file
+			const std::string &spellbook_file: user given spellbook info file (or snapshot)
+			library &lib: filled with the loaded data, release it with release_library even on failure
+Returns: a boolean value, true if everything loaded
+*/
+bool load_library(const std::string &wizard_file, const std::string &spellbook_file, library &lib) {
+	std::ifstream wizard_in;
+	std::ifstream spellbook_in;
+	if (not open_files(wizard_file, spellbook_file, wizard_in, spellbook_in)) {
+		return false;
+	}
+	lib.spellbook_file = spellbook_file;
+	scoped_timer timer(STAT_LOAD);
+
+	//the spellbook mapping doubles as the catalog's string pool, so it lives as long as the version
+	catalog_version* v = new catalog_version();
+	mapped_file wizard_map = {nullptr, 0, false};
+	bool mapped = map_file(wizard_file, wizard_map) && (lib.watching ?
+		read_whole_file(spellbook_file, v->spellbook_map) : map_file(spellbook_file, v->spellbook_map));
+	bool loaded;
+	if (mapped) {
+		loaded = read_in_mapped_data(wizard_map, v->spellbook_map, lib.wizards, lib.num_wizards, v->cat);
+	} else {
+		loaded = read_in_data(wizard_in, spellbook_in, lib.wizards, lib.num_wizards, v->cat);
+	}
+	unmap_file(wizard_map);
+	if (not loaded) {
+		delete_catalog_version(v);
+		return false;
+	}
+	if (lib.watching && mapped && not is_snapshot(v->spellbook_map))
+		hash_spellbook_records(*v);
+	timer.bytes = v->spellbook_map.size;
+
+	//keep only hashes of the passwords, and index the wizards by id once so each login attempt is a single lookup
+	lib.logins = build_login_index(lib.wizards, lib.num_wizards);
+	std::atomic_store(&lib.spellbooks, publish_version(v));
+	return true;
+}
+
+/*
+Function: release_library
+Description: deletes everything load_library made, safe to call on a partly loaded library. spellbook
+	versions still held by a session are deleted when that session lets go of them
+Parameters: library &lib: the library to release
+*/
+void release_library(library &lib) {
+	delete_login_index(lib.logins);
+	delete_wizards(lib.wizards);
+	std::atomic_store(&lib.spellbooks, std::shared_ptr<const catalog_version>());
+}
+
+/*
+Function: reload_spellbooks
+Description: loads the spellbook file again and publishes it as the library's new version. records that
+	are byte for byte the same as in the current version are copied over from it and only new or edited
+	spellbooks are parsed. queries already running keep the version they started on
+Parameters: library &lib: the loaded library
+			int &num_parsed: set to the number of spellbooks that had to be parsed
+			int &num_reused: set to the number of spellbooks copied from the current version
+Returns: a boolean value, true if the new version was published, false if the current one was kept
+*/
+bool reload_spellbooks(library &lib, int &num_parsed, int &num_reused) {
+	scoped_timer timer(STAT_RELOAD);
+	std::shared_ptr<const catalog_version> old = std::atomic_load(&lib.spellbooks);
+	catalog_version* v = new catalog_version();
+	num_parsed = 0;
+	num_reused = 0;
+	if (not read_whole_file(lib.spellbook_file, v->spellbook_map)) {
+		std::cerr << "Error: could not read " << lib.spellbook_file << std::endl;
+		delete_catalog_version(v);
+		return false;
+	}
+
+	//snapshots, and files the current version can't be matched against, are simply loaded again
+	bool ok;
+	if (is_snapshot(v->spellbook_map) || old == nullptr || old->record_hashes.empty()) {
+		ok = read_mapped_spellbooks(v->spellbook_map, v->cat);
+		num_parsed = ok ? v->cat.num_spellbooks : 0;
+	} else {
+		ok = hash_spellbook_records(*v);
+		std::unordered_map<std::uint64_t, int> old_records;
+		for (int i = (int)old->record_hashes.size() - 1; i >= 0; i--) {
+			old_records[old->record_hashes[i]] = i;
+		}
+
+		//the intern tables start over so they only hold names the new file uses, reused spellbooks get their
+		//ids remapped
+		std::vector<catalog_builder> parts(1);
+		catalog_builder &b = parts[0];
+		b.effects = create_effect_table();
+		std::vector<int> effect_ids(old->cat.effects.names.size(), -1);
+		std::vector<int> author_ids(old->cat.authors.names.size(), -1);
+
+		const char* base = v->spellbook_map.data;
+		for (int i = 0; ok && i < (int)v->record_hashes.size(); i++) {
+			const char* start = v->record_starts[i];
+			std::size_t length = v->record_starts[i + 1] - start;
+			auto found = old_records.find(v->record_hashes[i]);
+			int book = found == old_records.end() ? -1 : found->second;
+			if (book >= 0 && (std::size_t)(old->record_starts[book + 1] - old->record_starts[book]) == length &&
+					std::memcmp(old->record_starts[book], start, length) == 0) {
+				reuse_spellbook(*old, book, start - base, b, effect_ids, author_ids);
+				num_reused++;
+			} else {
+				token_cursor c = {start, v->record_starts[i + 1]};
+				ok = read_mapped_spellbook(c, base, b);
+				num_parsed++;
+			}
+		}
+		if (ok)
+			finish_catalog(parts, base, v->cat);
+		else
+			std::cerr << "Error: malformed spellbook file." << std::endl;
+	}
+	if (not ok) {
+		delete_catalog_version(v);
+		return false;
+	}
+
+	if (not is_snapshot(v->spellbook_map) && v->record_hashes.empty())
+		hash_spellbook_records(*v);
+	timer.bytes = v->spellbook_map.size;
+	std::atomic_store(&lib.spellbooks, publish_version(v));
+	return true;
+}
+
+/*
+Function: watch_spellbooks
+Description: background thread of --watch. checks the spellbook file every WATCH_INTERVAL and reloads it
+	when its size, modification time or inode changes. a file that doesn't load (e.g. caught halfway
+	through being written) is reported and the current version is kept until the next change. reports go
+	to std::cerr so they don't land in the middle of the menu's prompts or a script's output
+Parameters: library &lib: the loaded library, whose spellbooks are replaced
+			file_watch &watch: set stopping and notify wake to end the thread
+*/
+void watch_spellbooks(library &lib, file_watch &watch) {
+	struct stat last = {};
+	stat(lib.spellbook_file.c_str(), &last);
+
+	std::unique_lock<std::mutex> guard(watch.lock);
+	while (not watch.wake.wait_for(guard, WATCH_INTERVAL, [&watch]() { return watch.stopping; })) {
+		struct stat now;
+		if (stat(lib.spellbook_file.c_str(), &now) != 0)
+			continue; // mid-rename, try again next time
+		if (now.st_size == last.st_size && now.st_ino == last.st_ino && now.st_mtim.tv_sec == last.st_mtim.tv_sec &&
+				now.st_mtim.tv_nsec == last.st_mtim.tv_nsec)
+			continue;
+		last = now;
+
+		//don't hold up stop_watching while parsing
+		guard.unlock();
+		int num_parsed, num_reused;
+		if (reload_spellbooks(lib, num_parsed, num_reused)) {
+			std::cerr << "Reloaded " << lib.spellbook_file << ": " << num_parsed << " spellbooks parsed, "
+				<< num_reused << " unchanged" << std::endl;
+		}
+		guard.lock();
+	}
+}
+
+/*
+Function: stop_watching
+Description: stops the thread started for watch_spellbooks, if there is one
+Parameters: file_watch &watch: the watcher's stop flag
+			std::thread &watcher: the watcher thread, joined
+*/
+void stop_watching(file_watch &watch, std::thread &watcher) {
+	if (not watcher.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> guard(watch.lock);
+		watch.stopping = true;
+	}
+	watch.wake.notify_all();
+	watcher.join();
+}
+
+/*
+Function: refresh_session
+Description: moves a session onto the library's current spellbook version and its role's view of it, if
+	a reload published a new one. called before every query so a query runs on a single version
+Parameters: const library &lib: the loaded library
+			session &s: the logged-in wizard's session
+*/
+void refresh_session(const library &lib, session &s) {
+	std::shared_ptr<const catalog_version> current = std::atomic_load(&lib.spellbooks);
+	if (current == s.version)
+		return;
+	s.version = current;
+	s.view = &current->views[s.role];
+}
+
+/*
+Function: start_session
+Description: starts a session for a wizard that logged in, with the view of their role (students can't
+	see 'death' and 'poison' spells)
+Parameters: const library &lib: the loaded library
+			const wizard &user: the wizard that logged in
+			session &s: filled with the wizard's role and view
+*/
+void start_session(const library &lib, const wizard &user, session &s) {
+	s.user = &user;
+	s.role = find_role(user.position_title);
+	s.version = nullptr;
+	refresh_session(lib, s);
+}
+
+/*
+Function: effect_allowed
+Description: checks a searched effect the way the menu always has: only the known effects, and none
+	that the wizard's role hides
+Parameters: const session &s: the logged-in wizard's session
+			int effect: interned id of the effect (-1 if unknown)
+Returns: true if the wizard may search for the effect
+*/
+bool effect_allowed(const session &s, int effect) {
+	const role &r = ROLES[s.role];
+	return effect >= 0 && effect < NUM_KNOWN_EFFECTS &&
+		std::find(r.restricted, r.restricted + r.num_restricted, effect) == r.restricted + r.num_restricted;
+}
+
+/*
+Function: open_display_cursor
+Description: starts a cursor at the first spellbook
+Parameters: int page_size: spellbooks per page, 0 for all of them at once
+Returns: the new cursor
+*/
+display_cursor open_display_cursor(int page_size) {
+	return {0, std::max(page_size, 0)};
+}
+
+/*
+Function: seek_display_cursor
+Description: moves a cursor to the first spellbook (in catalog order) with the given title, or else with a
+	title starting with it, so paging carries on from there
+Parameters: display_cursor &cursor: the cursor to move
+			const session &s: the logged-in wizard's session
+			std::string_view title: title or start of a title to look for
+Returns: a boolean value, false if no title matches (the cursor doesn't move)
+*/
+bool seek_display_cursor(display_cursor &cursor, const session &s, std::string_view title) {
+	int book = find_title(s.version->cat, s.version->titles, title);
+	if (book < 0) {
+		std::vector<int> matches;
+		find_title_prefix(s.version->cat, s.version->titles, title, matches);
+		if (matches.empty())
+			return false;
+		book = *std::min_element(matches.begin(), matches.end());
+	}
+	cursor.next = book;
+	return true;
+}
+
+/*
+Function: write_display_page
+Description: formats the next page of 'display all' and moves the cursor past it. nothing beyond the page
+	is touched, so the first page costs the same however big the catalog is
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			display_cursor &cursor: where the page starts, moved to where the next one starts
+Returns: number of spellbooks written, 0 once the cursor is past the last spellbook
+*/
+int write_display_page(output_buffer &buffer, const session &s, display_cursor &cursor) {
+	const catalog &cat = s.version->cat;
+	int first = std::min(cursor.next, cat.num_spellbooks);
+	int last = cursor.page_size > 0 ? std::min(cat.num_spellbooks, first + cursor.page_size) : cat.num_spellbooks;
+	for (int i = first; i < last; i++) {
+		write_spellbook(buffer, cat, cat.spellbooks[i], s.view->visible);
+	}
+	cursor.next = last;
+	return last - first;
+}
+
+/*
+Function: write_all_spellbooks
+Description: formats every spellbook for 'display all', as a single page
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+*/
+void write_all_spellbooks(output_buffer &buffer, const session &s) {
+	display_cursor cursor = open_display_cursor(0);
+	write_display_page(buffer, s, cursor);
+}
+
+/*
+Function: spellbook_to_file
+Description: saves the spellbooks from the cursor on to a file, in the same format as 'display all', one
+	EXPORT_PAGE_SIZE page at a time. each page goes out to the file before the next is formatted, so the
+	export never holds more than a page however big the catalog is. filters out 'death' and 'poison'
+	spells if the logged in user is a student
+Parameters: std::ofstream &outfile: the open file to save to
+			const session &s: the logged-in wizard's session
+			display_cursor &cursor: where the export starts, moved past the last spellbook
+Returns: number of bytes written to the file
+*/
+std::size_t spellbook_to_file(std::ofstream &outfile, const session &s, display_cursor &cursor) {
+	output_buffer buffer = create_output_buffer(outfile);
+	cursor.page_size = EXPORT_PAGE_SIZE;
+	while (write_display_page(buffer, s, cursor) > 0) {
+		flush_output(buffer);
+	}
+	return buffer.bytes_written;
+}
+
+/*
+Function: write_title_search
+Description: 'search spellbook by its name'. an exact title match is written on its own, otherwise every
+	spellbook whose title starts with the name is written
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			std::string_view book_name: user given title or start of a title
+*/
+void write_title_search(output_buffer &buffer, const session &s, std::string_view book_name) {
+	scoped_timer timer(STAT_TITLE_SEARCH);
+	std::size_t start = buffered_bytes(buffer);
+	const catalog &cat = s.version->cat;
+	int book = find_title(cat, s.version->titles, book_name);
+	if (book >= 0) {
+		write_spellbook(buffer, cat, cat.spellbooks[book], s.view->visible);
+		timer.bytes = buffered_bytes(buffer) - start;
+		return;
+	}
+
+	//no exact match, so treat the name as the start of a title
+	std::vector<int> matches;
+	find_title_prefix(cat, s.version->titles, book_name, matches);
+	for (int match : matches) {
+		write_spellbook(buffer, cat, cat.spellbooks[match], s.view->visible);
+	}
+	//error handling for incorrect user input
+	if (matches.empty()) {
+		put_text(buffer, "No spellbook found with that name.\n");
+	}
+	timer.bytes = buffered_bytes(buffer) - start;
+}
+
+/*
+Function: write_effect_search
+Description: 'search spells by their effect'. only the spells listed under the effect in the inverted
+	index are visited
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			int effect: interned id of the effect to search for
+*/
+void write_effect_search(output_buffer &buffer, const session &s, int effect) {
+	const catalog &cat = s.version->cat;
+	const effect_index &effects = s.version->effects;
+
+	// postings of the chosen effect, empty if no spell has it
+	int first = 0;
+	int last = 0;
+	if (effect >= 0 && effect + 1 < (int)effects.offsets.size()) {
+		first = effects.offsets[effect];
+		last = effects.offsets[effect + 1];
+	}
+
+	for (int p = first; p < last; p++) {
+		const effect_posting &hit = effects.postings[p];
+		if (not spell_visible(s.view->visible, hit.spell))
+			continue;
+		put_text(buffer, "Spellbook: ");
+		put_text(buffer, pool_view(cat, cat.spellbooks[hit.book].title));
+		put_text(buffer, "\nSpell: ");
+		write_spell(buffer, cat, hit.spell);
+	}
+}
+
+/*
+Function: write_ranking
+Description: 'sort by average success rate'. ranks lightweight keys of the visible spells instead of
+	copying and swapping every spell
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			int top_k: number of best spells to write, 0 for all of them
+*/
+void write_ranking(output_buffer &buffer, const session &s, int top_k) {
+	scoped_timer timer(STAT_RANKING);
+	std::size_t start = buffered_bytes(buffer);
+	std::vector<rank_key> keys;
+	collect_rank_keys(s.version->cat, *s.view, keys);
+	rank_spells(keys, top_k, true);
+
+	for (const rank_key &k : keys) {
+		write_spell(buffer, s.version->cat, k.spell);
+	}
+	timer.bytes = buffered_bytes(buffer) - start;
+}
+
+/*
+Function: book_of_spell
+Description: finds the spellbook holding a spell with a binary search over the spellbooks' spell ranges
+Parameters: const catalog &cat: the loaded catalog
+			int spell: index of the spell in the spell columns
+Returns: index of the spellbook the spell belongs to
+*/
+int book_of_spell(const catalog &cat, int spell) {
+	//the last spellbook starting at or before the spell. an empty spellbook shares its spell_begin with the
+	//spellbook after it, so the last one is never empty
+	const spellbook* it = std::upper_bound(cat.spellbooks, cat.spellbooks + cat.num_spellbooks, spell,
+		[](int sp, const spellbook &sb) { return sp < sb.spell_begin; });
+	return (it - cat.spellbooks) - 1;
+}
+
+/*
+Function: find_query_field
+Description: looks a field name of the query language up in QUERY_FIELD_NAMES
+Parameters: const std::string &name: the field name
+Returns: the field, or NUM_QUERY_FIELDS if there is no such field
+*/
+query_field find_query_field(const std::string &name) {
+	int f = 0;
+	while (f < NUM_QUERY_FIELDS && name != QUERY_FIELD_NAMES[f])
+		f++;
+	return (query_field)f;
+}
+
+/*
+Function: text_field
+Description: tells the text fields, which only support = and !=, from the numeric ones
+Parameters: query_field field: the field
+Returns: true for title, author, name and effect
+*/
+bool text_field(query_field field) {
+	return field == FIELD_TITLE || field == FIELD_AUTHOR || field == FIELD_NAME || field == FIELD_EFFECT;
+}
+
+/*
+Function: numeric_value
+Description: reads a numeric field of a spell. success rates are kept as floats (widened exactly) so
+	'success_rate = 0.3' matches the 0.3 read from the file
+Parameters: const catalog &cat: the loaded catalog
+			int book: index of the spell's spellbook
+			int spell: index of the spell
+			query_field field: a numeric field
+Returns: the field's value
+*/
+double numeric_value(const catalog &cat, int book, int spell, query_field field) {
+	const spellbook &sb = cat.spellbooks[book];
+	switch (field) {
+	case FIELD_PAGES: return sb.num_pages;
+	case FIELD_EDITION: return sb.edition;
+	case FIELD_AVG_SUCCESS_RATE: return sb.avg_success_rate;
+	default: return cat.success_rates[spell];
+	}
+}
+
+/*
+Function: text_value
+Description: reads a text field of a spell as a view into the catalog
+Parameters: const catalog &cat: the loaded catalog
+			int book: index of the spell's spellbook
+			int spell: index of the spell
+			query_field field: a text field
+Returns: the field's text
+*/
+std::string_view text_value(const catalog &cat, int book, int spell, query_field field) {
+	switch (field) {
+	case FIELD_TITLE: return pool_view(cat, cat.spellbooks[book].title);
+	case FIELD_AUTHOR: return cat.authors.names[cat.spellbooks[book].author];
+	case FIELD_EFFECT: return cat.effects.names[cat.effect_ids[spell]];
+	default: return pool_view(cat, cat.names[spell]);
+	}
+}
+
+/*
+Function: compare_op
+Description: applies a comparison operator to two values
+Parameters: const T &a: the field's value
+			query_op op: the operator
+			const T &b: the predicate's value
+Returns: the result of 'a op b'
+*/
+template <typename T>
+bool compare_op(const T &a, query_op op, const T &b) {
+	switch (op) {
+	case OP_EQ: return a == b;
+	case OP_NE: return not (a == b);
+	case OP_LT: return a < b;
+	case OP_LE: return not (b < a);
+	case OP_GT: return b < a;
+	default: return not (a < b);
+	}
+}
+
+/*
+Function: predicate_matches
+Description: tests one predicate against a spell. author and effect compare interned ids, so they never
+	touch the strings
+Parameters: const catalog &cat: the loaded catalog
+			int book: index of the spell's spellbook
+			int spell: index of the spell
+			const query_predicate &p: the predicate
+Returns: true if the spell satisfies the predicate
+*/
+bool predicate_matches(const catalog &cat, int book, int spell, const query_predicate &p) {
+	switch (p.field) {
+	case FIELD_AUTHOR: return compare_op(cat.spellbooks[book].author, p.op, p.id);
+	case FIELD_EFFECT: return compare_op(cat.effect_ids[spell], p.op, p.id);
+	case FIELD_TITLE:
+	case FIELD_NAME: return compare_op(text_value(cat, book, spell, p.field), p.op, std::string_view(p.text));
+	default: return compare_op(numeric_value(cat, book, spell, p.field), p.op, p.number);
+	}
+}
+
+/*
+Function: parse_predicate
+Description: parses the 'field op value' of one predicate and resolves author and effect names to ids
+Parameters: std::istringstream &args: the query, positioned on the predicate
+			const catalog &cat: the catalog the query will run on
+			query_predicate &p: filled with the predicate
+			std::string &error: set to what went wrong when parsing fails
+Returns: a boolean value, true if the predicate parsed
+*/
+bool parse_predicate(std::istringstream &args, const catalog &cat, query_predicate &p, std::string &error) {
+	std::string field, op, value;
+	if (not (args >> field >> op >> value)) {
+		error = "expected 'field op value'";
+		return false;
+	}
+
+	p.field = find_query_field(field);
+	if (p.field == NUM_QUERY_FIELDS) {
+		error = "unknown field " + field;
+		return false;
+	}
+	int o = 0;
+	while (o < NUM_QUERY_OPS && op != QUERY_OP_NAMES[o])
+		o++;
+	if (o == NUM_QUERY_OPS || (text_field(p.field) && o != OP_EQ && o != OP_NE)) {
+		error = "can't compare " + field + " with " + op;
+		return false;
+	}
+	p.op = (query_op)o;
+	p.number = 0;
+	p.id = -1;
+	p.text = value;
+
+	if (p.field == FIELD_AUTHOR) {
+		p.id = find_string(cat.authors, value);
+	} else if (p.field == FIELD_EFFECT) {
+		p.id = find_string(cat.effects, value);
+	} else if (not text_field(p.field)) {
+		std::from_chars_result r = std::from_chars(value.data(), value.data() + value.size(), p.number);
+		if (r.ec != std::errc() || r.ptr != value.data() + value.size()) {
+			error = "not a number: " + value;
+			return false;
+		}
+		if (p.field == FIELD_SUCCESS_RATE || p.field == FIELD_AVG_SUCCESS_RATE)
+			p.number = (float)p.number;
+	}
+	return true;
+}
+
+/*
+Function: parse_query
+Description: parses the text of a 'find' query:
+		<predicate> [and|or <predicate>]... [sort <field> [asc|desc]...] [limit <n>]
+	and binds tighter than or. sort keys are ascending unless followed by desc
+Parameters: std::istringstream &args: the query, positioned after 'find'
+			const catalog &cat: the catalog the query will run on
+			spell_query &query: filled with the parsed query
+			std::string &error: set to what went wrong when parsing fails
+Returns: a boolean value, true if the whole query parsed
+*/
+bool parse_query(std::istringstream &args, const catalog &cat, spell_query &query, std::string &error) {
+	query.groups.assign(1, {});
+	query.sort.clear();
+	query.limit = 0;
+
+	query_predicate p;
+	if (not parse_predicate(args, cat, p, error))
+		return false;
+	query.groups.back().push_back(p);
+
+	//word is the next keyword, empty at the end of the query
+	std::string word;
+	auto next_word = [&args, &word]() {
+		word.clear();
+		args >> word;
+	};
+
+	next_word();
+	while (word == "and" || word == "or") {
+		if (word == "or")
+			query.groups.emplace_back();
+		if (not parse_predicate(args, cat, p, error))
+			return false;
+		query.groups.back().push_back(p);
+		next_word();
+	}
+
+	if (word == "sort") {
+		next_word();
+		while (not word.empty() && word != "limit") {
+			if (word == "asc" || word == "desc") {
+				if (query.sort.empty()) {
+					error = "sort needs a field before " + word;
+					return false;
+				}
+				query.sort.back().descending = word == "desc";
+			} else {
+				query_field f = find_query_field(word);
+				if (f == NUM_QUERY_FIELDS) {
+					error = "unknown field " + word;
+					return false;
+				}
+				query.sort.push_back({f, false});
+			}
+			next_word();
+		}
+		if (query.sort.empty()) {
+			error = "sort needs a field";
+			return false;
+		}
+	}
+
+	if (word == "limit") {
+		if (not (args >> query.limit) || query.limit < 1) {
+			error = "limit needs a positive count";
+			return false;
+		}
+		next_word();
+	}
+
+	if (not word.empty()) {
+		error = "unexpected " + word;
+		return false;
+	}
+	return true;
+}
+
+/*
+Function: plan_group
+Description: picks the cheapest way to read the candidates of one AND group: the postings of an
+	'effect =' predicate, the success_rate range of the rate index, the spellbooks of a 'title =' predicate,
+	or else a scan of every spellbook
+Parameters: const catalog_version &v: the version the query runs on
+			const std::vector<query_predicate> &group: the group's predicates
+Returns: the chosen plan
+*/
+query_plan plan_group(const catalog_version &v, const std::vector<query_predicate> &group) {
+	const catalog &cat = v.cat;
+	query_plan plan = {ACCESS_BOOK_SCAN, 0, 0, {}, cat.num_spells};
+
+	bool rate_range = false;
+	for (const query_predicate &p : group) {
+		if (p.field == FIELD_EFFECT && p.op == OP_EQ) {
+			int first = 0;
+			int last = 0;
+			if (p.id >= 0 && p.id + 1 < (int)v.effects.offsets.size()) {
+				first = v.effects.offsets[p.id];
+				last = v.effects.offsets[p.id + 1];
+			}
+			if (last - first < plan.estimate)
+				plan = {ACCESS_EFFECT_INDEX, first, last, {}, last - first};
+		} else if (p.field == FIELD_TITLE && p.op == OP_EQ) {
+			std::vector<int> books;
+			find_title_prefix(cat, v.titles, p.text, books);
+			long long spells = 0;
+			int kept = 0;
+			for (int b : books) {
+				if (pool_view(cat, cat.spellbooks[b].title).size() != p.text.size())
+					continue;
+				books[kept++] = b;
+				spells += cat.spellbooks[b].spell_end - cat.spellbooks[b].spell_begin;
+			}
+			books.resize(kept);
+			std::sort(books.begin(), books.end()); // catalog order, like a scan
+			if (spells < plan.estimate)
+				plan = {ACCESS_TITLE_INDEX, 0, 0, books, spells};
+		} else if (p.field == FIELD_SUCCESS_RATE && p.op != OP_NE) {
+			rate_range = true;
+		}
+	}
+	if (not rate_range)
+		return plan;
+
+	//by_rate runs from the highest rate down, so each bound cuts off one end of it
+	const std::vector<rank_key> &by_rate = rate_order(v);
+	std::vector<rank_key>::const_iterator first = by_rate.begin();
+	std::vector<rank_key>::const_iterator last = by_rate.end();
+	for (const query_predicate &p : group) {
+		if (p.field != FIELD_SUCCESS_RATE)
+			continue;
+		double x = p.number;
+		if (p.op == OP_LT || p.op == OP_LE || p.op == OP_EQ) {
+			first = std::partition_point(first, last, [x, &p](const rank_key &k) {
+				return p.op == OP_LT ? k.success_rate >= x : k.success_rate > x;
+			});
+		}
+		if (p.op == OP_GT || p.op == OP_GE || p.op == OP_EQ) {
+			last = std::partition_point(first, last, [x, &p](const rank_key &k) {
+				return p.op == OP_GT ? k.success_rate > x : k.success_rate >= x;
+			});
+		}
+	}
+	if (last - first < plan.estimate) {
+		plan = {ACCESS_RATE_INDEX, (int)(first - by_rate.begin()), (int)(last - by_rate.begin()), {},
+			last - first};
+	}
+	return plan;
+}
+
+/*
+Function: run_spell_query
+Description: runs every group of a query through its plan, keeps the visible spells that satisfy the whole
+	group, and orders the union by the query's sort keys (catalog order for ties), cut to its limit
+Parameters: const session &s: the logged-in wizard's session
+			const spell_query &query: the parsed query
+			std::vector<int> &results: filled with the matching spell indices, in output order
+*/
+void run_spell_query(const session &s, const spell_query &query, std::vector<int> &results) {
+	const catalog &cat = s.version->cat;
+	spell_mask matched((cat.num_spells + 63) / 64, 0);
+
+	for (const std::vector<query_predicate> &group : query.groups) {
+		query_plan plan = plan_group(*s.version, group);
+		std::vector<query_predicate> book_preds;
+		for (const query_predicate &p : group) {
+			if (p.field < FIELD_NAME)
+				book_preds.push_back(p);
+		}
+
+		auto visit = [&](int book, int spell) {
+			if (not spell_visible(s.view->visible, spell) || spell_visible(matched, spell))
+				return;
+			for (const query_predicate &p : group) {
+				if (not predicate_matches(cat, book, spell, p))
+					return;
+			}
+			matched[spell / 64] |= std::uint64_t(1) << (spell % 64);
+		};
+
+		if (plan.access == ACCESS_EFFECT_INDEX) {
+			for (int p = plan.first; p < plan.last; p++)
+				visit(s.version->effects.postings[p].book, s.version->effects.postings[p].spell);
+		} else if (plan.access == ACCESS_RATE_INDEX) {
+			const std::vector<rank_key> &by_rate = rate_order(*s.version);
+			for (int k = plan.first; k < plan.last; k++)
+				visit(book_of_spell(cat, by_rate[k].spell), by_rate[k].spell);
+		} else {
+			//a book scan rejects whole spellbooks on their own fields before looking at any spell
+			std::vector<int> all_books;
+			if (plan.access == ACCESS_BOOK_SCAN) {
+				all_books.resize(cat.num_spellbooks);
+				for (int i = 0; i < cat.num_spellbooks; i++)
+					all_books[i] = i;
+			}
+			for (int b : plan.access == ACCESS_BOOK_SCAN ? all_books : plan.books) {
+				bool book_matches = true;
+				for (const query_predicate &p : book_preds)
+					book_matches = book_matches && predicate_matches(cat, b, cat.spellbooks[b].spell_begin, p);
+				if (not book_matches)
+					continue;
+				for (int j = cat.spellbooks[b].spell_begin; j < cat.spellbooks[b].spell_end; j++)
+					visit(b, j);
+			}
+		}
+	}
+
+	results.clear();
+	for (int i = 0; i < cat.num_spells; i++) {
+		if (spell_visible(matched, i))
+			results.push_back(i);
+	}
+	if (query.sort.empty()) {
+		if (query.limit > 0 && query.limit < (int)results.size())
+			results.resize(query.limit);
+		return;
+	}
+
+	//sort on (book, spell) pairs so the spellbook fields don't need a search per comparison
+	std::vector<effect_posting> rows(results.size());
+	for (std::size_t r = 0; r < results.size(); r++)
+		rows[r] = {book_of_spell(cat, results[r]), results[r]};
+	auto before = [&cat, &query](const effect_posting &a, const effect_posting &b) {
+		for (const query_sort_key &key : query.sort) {
+			int c;
+			if (text_field(key.field)) {
+				c = text_value(cat, a.book, a.spell, key.field).compare(text_value(cat, b.book, b.spell, key.field));
+			} else {
+				double x = numeric_value(cat, a.book, a.spell, key.field);
+				double y = numeric_value(cat, b.book, b.spell, key.field);
+				c = x < y ? -1 : (y < x ? 1 : 0);
+			}
+			if (c != 0)
+				return key.descending ? c > 0 : c < 0;
+		}
+		return a.spell < b.spell;
+	};
+	if (query.limit > 0 && query.limit < (int)rows.size()) {
+		std::partial_sort(rows.begin(), rows.begin() + query.limit, rows.end(), before);
+		rows.resize(query.limit);
+	} else {
+		std::sort(rows.begin(), rows.end(), before);
+	}
+	results.resize(rows.size());
+	for (std::size_t r = 0; r < rows.size(); r++)
+		results[r] = rows[r].spell;
+}
+
+/*
+Function: write_find
+Description: 'find'. writes the spells matching a query in the effect search's format
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			const spell_query &query: the parsed query
+*/
+void write_find(output_buffer &buffer, const session &s, const spell_query &query) {
+	scoped_timer timer(STAT_FIND);
+	std::size_t start = buffered_bytes(buffer);
+	const catalog &cat = s.version->cat;
+	std::vector<int> results;
+	run_spell_query(s, query, results);
+
+	for (int spell : results) {
+		put_text(buffer, "Spellbook: ");
+		put_text(buffer, pool_view(cat, cat.spellbooks[book_of_spell(cat, spell)].title));
+		put_text(buffer, "\nSpell: ");
+		write_spell(buffer, cat, spell);
+	}
+	timer.bytes = buffered_bytes(buffer) - start;
+}
+
+/*
+Function: write_query_plan
+Description: 'explain find'. writes the access path the planner picks for each group of a query, with the
+	number of spells it will visit, followed by the filters, sort keys and limit
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			const spell_query &query: the parsed query
+*/
+void write_query_plan(output_buffer &buffer, const session &s, const spell_query &query) {
+	const char* const ACCESS_NAMES[] = {"book scan", "effect index", "rate index", "title index"};
+	for (std::size_t g = 0; g < query.groups.size(); g++) {
+		query_plan plan = plan_group(*s.version, query.groups[g]);
+		put_text(buffer, "group ");
+		put_int(buffer, g + 1);
+		put_text(buffer, ": ");
+		put_text(buffer, ACCESS_NAMES[plan.access]);
+		put_text(buffer, ", ");
+		put_int(buffer, plan.estimate);
+		put_text(buffer, " spells\n");
+		for (const query_predicate &p : query.groups[g]) {
+			put_text(buffer, "\tfilter ");
+			put_text(buffer, QUERY_FIELD_NAMES[p.field]);
+			put_text(buffer, " ");
+			put_text(buffer, QUERY_OP_NAMES[p.op]);
+			put_text(buffer, " ");
+			put_text(buffer, p.text);
+			put_text(buffer, "\n");
+		}
+	}
+	if (not query.sort.empty()) {
+		put_text(buffer, "sort");
+		for (const query_sort_key &key : query.sort) {
+			put_text(buffer, " ");
+			put_text(buffer, QUERY_FIELD_NAMES[key.field]);
+			put_text(buffer, key.descending ? " desc" : " asc");
+		}
+		put_text(buffer, "\n");
+	}
+	if (query.limit > 0) {
+		put_text(buffer, "limit ");
+		put_int(buffer, query.limit);
+		put_text(buffer, "\n");
+	}
+}
+
+/*
+Function: write_aggregate_row
+Description: appends one aggregate as a "key count n sum s mean m min x max y histogram h0 ... h9" line
+Parameters: output_buffer &buffer: the buffer to append to
+			std::string_view key: the effect, author or edition the aggregate covers
+			const rate_aggregate &agg: the aggregate, with at least one spell
+*/
+void write_aggregate_row(output_buffer &buffer, std::string_view key, const rate_aggregate &agg) {
+	put_text(buffer, key);
+	put_text(buffer, " count ");
+	put_int(buffer, agg.count);
+	put_text(buffer, " sum ");
+	put_float(buffer, agg.sum);
+	put_text(buffer, " mean ");
+	put_float(buffer, agg.sum / agg.count);
+	put_text(buffer, " min ");
+	put_float(buffer, agg.min);
+	put_text(buffer, " max ");
+	put_float(buffer, agg.max);
+	put_text(buffer, " histogram");
+	for (int k = 0; k < NUM_RATE_BUCKETS; k++) {
+		put_text(buffer, " ");
+		put_int(buffer, agg.histogram[k]);
+	}
+	put_text(buffer, "\n");
+}
+
+/*
+Function: write_aggregates
+Description: 'aggregate'. writes the success rate aggregates of one grouping (effect, author or edition)
+	from the tables built at load time: one key's row, the top_k rows with the best mean, or every row in
+	key order. groups with no spell the wizard may see are left out
+Parameters: output_buffer &buffer: where to write
+			const session &s: the logged-in wizard's session
+			const std::string &group: "effect", "author" or "edition"
+			const std::string &key: the one key to write, empty for several rows
+			int top_k: with no key, number of rows with the best mean to write, 0 for all rows in key order
+Returns: a boolean value, false if the group or key is unknown (an error line is written)
+*/
+bool write_aggregates(output_buffer &buffer, const session &s, const std::string &group, const std::string &key,
+						int top_k) {
+	const catalog &cat = s.version->cat;
+	const aggregate_tables &tables = s.view->aggregates;
+
+	//rows[i] is the aggregate of names[i], the group's keys
+	const std::vector<rate_aggregate>* rows;
+	std::vector<std::string> editions;
+	const std::deque<std::string>* names;
+	if (group == "effect") {
+		rows = &tables.by_effect;
+		names = &cat.effects.names;
+	} else if (group == "author") {
+		rows = &tables.by_author;
+		names = &cat.authors.names;
+	} else if (group == "edition") {
+		rows = &tables.by_edition;
+		for (int e : tables.editions)
+			editions.push_back(std::to_string(e));
+		names = nullptr;
+	} else {
+		put_text(buffer, "Error: can only aggregate by effect, author or edition\n");
+		return false;
+	}
+	auto name_of = [&](int row) -> std::string_view {
+		return names != nullptr ? std::string_view((*names)[row]) : std::string_view(editions[row]);
+	};
+
+	if (not key.empty()) {
+		int row = -1;
+		if (group == "effect") {
+			row = find_string(cat.effects, key);
+		} else if (group == "author") {
+			row = find_string(cat.authors, key);
+		} else {
+			int edition;
+			std::from_chars_result r = std::from_chars(key.data(), key.data() + key.size(), edition);
+			std::unordered_map<int, int>::const_iterator it = tables.edition_rows.find(edition);
+			if (r.ec == std::errc() && r.ptr == key.data() + key.size() && it != tables.edition_rows.end())
+				row = it->second;
+		}
+		if (row < 0 || (*rows)[row].count == 0) {
+			put_text(buffer, "Error: no spells for " + group + " " + key + "\n");
+			return false;
+		}
+		write_aggregate_row(buffer, key, (*rows)[row]);
+		return true;
+	}
+
+	std::vector<int> order;
+	for (int row = 0; row < (int)rows->size(); row++) {
+		if ((*rows)[row].count > 0)
+			order.push_back(row);
+	}
+	if (top_k > 0) {
+		//best mean first, equal means in key order
+		std::sort(order.begin(), order.end(), [&](int a, int b) {
+			double mean_a = (*rows)[a].sum / (*rows)[a].count;
+			double mean_b = (*rows)[b].sum / (*rows)[b].count;
+			if (mean_a != mean_b)
+				return mean_a > mean_b;
+			return names != nullptr ? name_of(a) < name_of(b) : a < b;
+		});
+		order.resize(std::min(top_k, (int)order.size()));
+	} else if (names != nullptr) {
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return name_of(a) < name_of(b); });
+	}
+
+	for (int row : order) {
+		write_aggregate_row(buffer, name_of(row), (*rows)[row]);
+	}
+	return true;
+}
+
+/*
+Function: display_selection_effect
+Description: search and display function for 'search by effect', filtering 'death' and 'poison' out for students. 
+	saves to file or prints to screen depending on user input
+Parameters: const session &s: the logged-in wizard's session
+			int effect: interned id of the effect to search for
+*/
+void display_selection_effect(const session &s, int effect) {
+    int display_choice;
+    do {
+        std::cout << "How would you like the information displayed?" << std::endl;
+        std::cout << "1. Print to screen" << std::endl;
+        std::cout << "2. Print to file" << std::endl;
+        std::cout << "Your Choice: ";
+        std::cin >> display_choice;
+    } while (display_choice != 1 && display_choice != 2);
+
+    // print spells with the user-chosen effect, to the screen or to a user given file
+    if (display_choice == 1) {
+        scoped_timer timer(STAT_EFFECT_SEARCH);
+        output_buffer buffer = create_output_buffer(std::cout);
+        write_effect_search(buffer, s, effect);
+        flush_output(buffer);
+        timer.bytes = buffer.bytes_written;
+        return;
+    }
+
+    std::string filename;
+    std::cout << "Please enter filename: ";
+    std::cin >> filename;
+    {
+        scoped_timer timer(STAT_EXPORT);
+        std::ofstream outfile(filename);
+        output_buffer buffer = create_output_buffer(outfile);
+        write_effect_search(buffer, s, effect);
+        flush_output(buffer);
+        outfile.close();
+        timer.bytes = buffer.bytes_written;
+    }
+    std::cout << "Saved to file!" << std::endl;
+}
+
+/*
+Function: export_shards
+Description: exports the catalog to several files at once: one per effect (its spells, as in 'search
+	spells by their effect'), one per author (their spellbooks, as in 'display all'), or num_shards files
+	with the spellbooks spread by a hash of their title. the files are formatted and written concurrently,
+	each by one thread of a pool that takes the next file as soon as it is done, in OUTPUT_BLOCK_SIZE writes.
+	files are named <prefix><effect, author or shard number>.txt, and effects and authors with nothing
+	the wizard may see get no file
+Parameters: const session &s: the logged-in wizard's session
+			const std::string &prefix: start of every file name, e.g. a directory ending in '/'
+			shard_key key: what to split the catalog by
+			int num_shards: number of files for SHARD_BY_HASH, at most MAX_EXPORT_SHARDS
+			int &num_files: set to the number of files written
+			std::string &error: set to what went wrong if a file couldn't be written
+Returns: number of bytes written to the files
+*/
+std::size_t export_shards(const session &s, const std::string &prefix, shard_key key, int num_shards,
+							int &num_files, std::string &error) {
+	const catalog &cat = s.version->cat;
+	const aggregate_tables &visible_counts = s.view->aggregates;
+	std::vector<shard_task> tasks;
+	auto file_name = [&prefix](std::string name) {
+		std::replace(name.begin(), name.end(), '/', '_');
+		return prefix + name + ".txt";
+	};
+
+	if (key == SHARD_BY_EFFECT) {
+		for (int e = 0; e < (int)cat.effects.names.size(); e++) {
+			if (visible_counts.by_effect[e].count > 0)
+				tasks.push_back({file_name(cat.effects.names[e]), e, {}});
+		}
+	} else if (key == SHARD_BY_AUTHOR) {
+		std::vector<int> task_of(cat.authors.names.size(), -1);
+		for (int i = 0; i < cat.num_spellbooks; i++) {
+			int author = cat.spellbooks[i].author;
+			if (visible_counts.by_author[author].count == 0)
+				continue;
+			int &t = task_of[author];
+			if (t == -1) {
+				t = tasks.size();
+				tasks.push_back({file_name(cat.authors.names[author]), -1, {}});
+			}
+			tasks[t].books.push_back(i);
+		}
+	} else {
+		for (int t = 0; t < num_shards; t++)
+			tasks.push_back({file_name(std::to_string(t)), -1, {}});
+		for (int i = 0; i < cat.num_spellbooks; i++) {
+			std::string_view title = pool_view(cat, cat.spellbooks[i].title);
+			tasks[record_hash(title.data(), title.data() + title.size()) % num_shards].books.push_back(i);
+		}
+	}
+
+	std::atomic<int> next_task(0);
+	std::atomic<std::size_t> bytes(0);
+	std::mutex error_lock;
+	auto worker = [&]() {
+		for (int t = next_task++; t < (int)tasks.size(); t = next_task++) {
+			const shard_task &task = tasks[t];
+			std::ofstream outfile(task.filename);
+			if (outfile) {
+				output_buffer buffer = create_output_buffer(outfile);
+				if (task.effect >= 0) {
+					write_effect_search(buffer, s, task.effect);
+				} else {
+					for (int book : task.books)
+						write_spellbook(buffer, cat, cat.spellbooks[book], s.view->visible);
+				}
+				flush_output(buffer);
+				outfile.close();
+				bytes += buffer.bytes_written;
+			}
+			if (not outfile) {
+				std::lock_guard<std::mutex> hold(error_lock);
+				error = "could not write " + task.filename;
+			}
+		}
+	};
+
+	int num_threads = std::max(1, std::min<int>(std::thread::hardware_concurrency(), tasks.size()));
+	std::vector<std::thread> workers;
+	for (int t = 1; t < num_threads; t++)
+		workers.emplace_back(worker);
+	worker();
+	for (std::thread &w : workers) w.join();
+
+	num_files = tasks.size();
+	return bytes;
+}
+
+/*
+Function: display_selection_all
+Description: 'display all' for the menu. with a page size, formats and prints one page of spellbooks at a
+	time and asks whether to go on, skip ahead to a title or go back to the menu
+Parameters: const session &s: the logged-in wizard's session
+			int page_size: spellbooks per page, 0 to print them all at once
+*/
+void display_selection_all(const session &s, int page_size) {
+    display_cursor cursor = open_display_cursor(page_size);
+    int num_spellbooks = s.version->cat.num_spellbooks;
+    bool show_page = true;
+    while (true) {
+        if (show_page) {
+            scoped_timer timer(STAT_DISPLAY_ALL);
+            output_buffer buffer = create_output_buffer(std::cout);
+            write_display_page(buffer, s, cursor);
+            flush_output(buffer);
+            timer.bytes = buffer.bytes_written;
+        }
+        if (page_size == 0 || cursor.next >= num_spellbooks)
+            return;
+
+        std::cout << "Shown up to spellbook " << cursor.next << " of " << num_spellbooks << "." << std::endl;
+        std::cout << "n. Next page" << std::endl;
+        std::cout << "s <title>. Skip to a spellbook" << std::endl;
+        std::cout << "q. Back to the menu" << std::endl;
+        std::cout << "Your Choice: ";
+        std::string choice;
+        std::cin >> choice;
+
+        show_page = true;
+        if (choice == "s") {
+            std::string title;
+            std::cin >> title;
+            if (not seek_display_cursor(cursor, s, title)) {
+                std::cout << "No spellbook found with that name." << std::endl;
+                show_page = false;
+            }
+        } else if (choice != "n") {
+            return;
+        }
+    }
+}
+
+/*
+Function: display_selection_avg_success
+Description: sorts spells and prints them to the terminal
+Parameters: const session &s: the logged-in wizard's session
+*/
+void display_selection_avg_success(const session &s) {
+    output_buffer buffer = create_output_buffer(std::cout);
+    write_ranking(buffer, s, 0);
+    flush_output(buffer);
+}
+
+/*
+Function: run_session_command
+Description: the part of a query line every script and server mode handles the same way: skips blank lines
+	and comments, answers login and stats, and refuses everything else until someone has logged in. a
+	login only sets the session's wizard and role, the caller moves it onto the spellbooks it queries
+Parameters: const library &lib: the wizards and their login index
+			session &s: the script's or client's session, changed by login
+			std::istringstream &args: the command line, moved past what was read
+			std::string &command: set to the line's first word
+			output_buffer &buffer: where to write the answer
+Returns: COMMAND_OK or COMMAND_FAILED if the line was answered, COMMAND_QUERY if it is a query for the caller
+*/
+command_result run_session_command(const library &lib, session &s, std::istringstream &args, std::string &command,
+									output_buffer &buffer) {
+	if (not (args >> command) || command[0] == '#')
+		return COMMAND_OK;
+
+	if (command == "login") {
+		int id;
+		std::string password;
+		const wizard* user = nullptr;
+		login_result result = LOGIN_FAILED;
+		if (args >> id >> password)
+			result = login_verification(lib.wizards, lib.num_wizards, lib.logins, id, password, user);
+		if (result != LOGIN_OK) {
+			count_event(COUNTER_FAILED_LOGINS);
+			if (result == LOGIN_THROTTLED)
+				count_event(COUNTER_THROTTLED_LOGINS);
+			put_text(buffer, result == LOGIN_THROTTLED ? "Error: too many failed logins for that id, try again later\n" :
+				"Incorrect id or password.\n");
+			return COMMAND_FAILED;
+		}
+		s = {user, find_role(user->position_title), nullptr, nullptr};
+		put_text(buffer, "Welcome, ");
+		put_text(buffer, user->name);
+		put_text(buffer, "!\n");
+		return COMMAND_OK;
+	}
+
+	if (command == "stats") {
+		std::string format;
+		args >> format;
+		if (not stats_enabled) {
+			put_text(buffer, "Error: stats are off, start with --stats\n");
+			return COMMAND_FAILED;
+		}
+		write_stats(buffer, format == "json");
+		return COMMAND_OK;
+	}
+
+	if (s.user == nullptr) {
+		put_text(buffer, "Error: log in first\n");
+		return COMMAND_FAILED;
+	}
+	return COMMAND_QUERY;
+}
+
+/*
+Function: run_query
+Description: runs one line of a batch query script against the loaded library, writing the results the
+	same way the menu would print them. the commands are
+		login <id> <password>		log in (every other command needs a logged-in wizard)
+		display						display all spellbooks
+		page <n> [title]			the first n spellbooks of 'display', or the n from the first with the title
+		name <title>				search spellbook by its name (or the start of it)
+		effect <effect>				search spells by their effect
+		rank [k]					spells by success rate, optionally only the best k
+		find <query>				spells matching a query (see parse_query), e.g.
+									find effect = fire and success_rate >= 0.5 sort pages desc limit 10
+		explain find <query>		how find would run the query
+		aggregate <group> [key|top k]	success rate count, sum, mean, min, max and histogram per effect,
+									author or edition: one key, the k best by mean, or all of them
+		export <file> [effect]		save all spellbooks, or the spells with an effect, to a file
+		shard <prefix> <by>			save to one file per effect or author (by = effect or author), or to
+									by files split by title hash, written in parallel (see export_shards)
+	blank lines and lines starting with # are skipped
+Parameters: const library &lib: the loaded library
+			session &s: the script's session, changed by login
+			const std::string &line: the command line
+			output_buffer &buffer: where to write the results
+			bool allow_export: false to refuse export (the query server doesn't write files for its clients)
+Returns: a boolean value, false if the command failed (an error line is written)
+*/
+bool run_query(const library &lib, session &s, const std::string &line, output_buffer &buffer, bool allow_export) {
+	std::istringstream args(line);
+	std::string command;
+	command_result answered = run_session_command(lib, s, args, command, buffer);
+	if (answered != COMMAND_QUERY)
+		return answered == COMMAND_OK;
+	refresh_session(lib, s);
+
+	std::string text;
+	if (command == "display") {
+		scoped_timer timer(STAT_DISPLAY_ALL);
+		std::size_t start = buffered_bytes(buffer);
+		write_all_spellbooks(buffer, s);
+		timer.bytes = buffered_bytes(buffer) - start;
+	} else if (command == "page") {
+		int page_size;
+		display_cursor cursor;
+		if (not (args >> page_size) || page_size < 1) {
+			put_text(buffer, "Error: page needs a positive size\n");
+			return false;
+		}
+		cursor = open_display_cursor(page_size);
+		if (args >> text && not seek_display_cursor(cursor, s, text)) {
+			put_text(buffer, "No spellbook found with that name.\n");
+			return false;
+		}
+		scoped_timer timer(STAT_DISPLAY_ALL);
+		std::size_t start = buffered_bytes(buffer);
+		write_display_page(buffer, s, cursor);
+		timer.bytes = buffered_bytes(buffer) - start;
+	} else if (command == "name" && args >> text) {
+		write_title_search(buffer, s, text);
+	} else if (command == "effect" && args >> text) {
+		int effect = find_string(s.version->cat.effects, text);
+		if (not effect_allowed(s, effect)) {
+			put_text(buffer, "Error: Invalid spell effect\n");
+			return false;
+		}
+		scoped_timer timer(STAT_EFFECT_SEARCH);
+		std::size_t start = buffered_bytes(buffer);
+		write_effect_search(buffer, s, effect);
+		timer.bytes = buffered_bytes(buffer) - start;
+	} else if (command == "rank") {
+		int top_k = 0;
+		if (not (args >> top_k))
+			top_k = 0;
+		write_ranking(buffer, s, std::max(top_k, 0));
+	} else if (command == "find" || (command == "explain" && args >> text && text == "find")) {
+		spell_query query;
+		std::string error;
+		if (not parse_query(args, s.version->cat, query, error)) {
+			put_text(buffer, "Error: " + error + "\n");
+			return false;
+		}
+		if (command == "explain")
+			write_query_plan(buffer, s, query);
+		else
+			write_find(buffer, s, query);
+	} else if (command == "aggregate" && args >> text) {
+		std::string key;
+		int top_k = 0;
+		if (args >> key && key == "top") {
+			key.clear();
+			if (not (args >> top_k) || top_k < 1) {
+				put_text(buffer, "Error: top needs a positive count\n");
+				return false;
+			}
+		}
+		if (not write_aggregates(buffer, s, text, key, top_k))
+			return false;
+	} else if ((command == "export" || command == "shard") && not allow_export) {
+		put_text(buffer, "Error: export is not available here\n");
+		return false;
+	} else if (command == "shard" && args >> text) {
+		std::string by;
+		shard_key key = SHARD_BY_HASH;
+		int num_shards = 0;
+		if (args >> by && by == "effect")
+			key = SHARD_BY_EFFECT;
+		else if (by == "author")
+			key = SHARD_BY_AUTHOR;
+		else
+			num_shards = std::atoi(by.c_str());
+		if (key == SHARD_BY_HASH && (num_shards < 1 || num_shards > MAX_EXPORT_SHARDS)) {
+			put_text(buffer, "Error: shard by effect, author or a number of files from 1 to " +
+				std::to_string(MAX_EXPORT_SHARDS) + "\n");
+			return false;
+		}
+
+		scoped_timer timer(STAT_EXPORT);
+		int num_files = 0;
+		std::string error;
+		timer.bytes = export_shards(s, text, key, num_shards, num_files, error);
+		if (not error.empty()) {
+			put_text(buffer, "Error: " + error + "\n");
+			return false;
+		}
+		put_text(buffer, "Saved " + std::to_string(num_files) + " files!\n");
+	} else if (command == "export" && args >> text) {
+		std::string effect_name;
+		int effect = -1;
+		if (args >> effect_name) {
+			effect = find_string(s.version->cat.effects, effect_name);
+			if (not effect_allowed(s, effect)) {
+				put_text(buffer, "Error: Invalid spell effect\n");
+				return false;
+			}
+		}
+
+		scoped_timer timer(STAT_EXPORT);
+		std::ofstream outfile(text);
+		if (not outfile) {
+			put_text(buffer, "Error: could not open " + text + "\n");
+			return false;
+		}
+		if (effect >= 0) {
+			output_buffer file_buffer = create_output_buffer(outfile);
+			write_effect_search(file_buffer, s, effect);
+			flush_output(file_buffer);
+			timer.bytes = file_buffer.bytes_written;
+		} else {
+			display_cursor cursor = open_display_cursor(EXPORT_PAGE_SIZE);
+			timer.bytes = spellbook_to_file(outfile, s, cursor);
+		}
+		put_text(buffer, "Saved to file!\n");
+	} else {
+		put_text(buffer, "Error: unknown or incomplete command: " + line + "\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+Function: run_script
+Description: runs every line of a query script, streaming the results to the terminal, and counts the
+	lines that fail
+Parameters: const std::string &query_file: the query script, "-" to read it from std::cin
+			run_line: called as run_line(session &s, const std::string &line, output_buffer &buffer) for each
+				line with the script's one session, returns false if the line failed
+Returns: exit status for main, 0 if every query succeeded and 1 if not
+*/
+template <typename line_function>
+int run_script(const std::string &query_file, line_function run_line) {
+	std::ifstream script;
+	if (query_file != "-") {
+		script.open(query_file);
+		if (not script) {
+			std::cout << "Error: could not open query file " << query_file << std::endl;
+			return 1;
+		}
+	}
+	std::istream &in = query_file == "-" ? std::cin : script;
+
+	session s = {nullptr, 0, nullptr, nullptr};
+	output_buffer buffer = create_output_buffer(std::cout);
+	bool all_ok = true;
+	std::string line;
+	while (std::getline(in, line)) {
+		bool ok = run_line(s, line, buffer);
+		if (not ok)
+			count_event(COUNTER_FAILED_QUERIES);
+		all_ok = ok && all_ok;
+	}
+	flush_output(buffer);
+	return all_ok ? 0 : 1;
+}
+
+/*
+Function: run_batch
+Description: non-interactive mode. runs every line of a query script against one loaded library and
+	streams the results to the terminal
+Parameters: const library &lib: the loaded library
+			const std::string &query_file: the query script, "-" to read it from std::cin
+Returns: exit status for main, 0 if every query succeeded and 1 if not
+*/
+int run_batch(const library &lib, const std::string &query_file) {
+	return run_script(query_file, [&lib](session &s, const std::string &line, output_buffer &buffer) {
+		return run_query(lib, s, line, buffer, true);
+	});
+}
+
+/*
+Function: load_wizards
+Description: loads only the wizard file and its login index, for streaming mode which leaves the
+	spellbooks on disk
+Parameters: const std::string &wizard_file: user given wizard info file
+			library &lib: filled with the wizards, release it with release_library even on failure
+Returns: a boolean value, true if the wizards loaded
+*/
+bool load_wizards(const std::string &wizard_file, library &lib) {
+	mapped_file wizard_map = {nullptr, 0, false};
+	bool loaded;
+	if (map_file(wizard_file, wizard_map)) {
+		loaded = read_mapped_wizards(wizard_map, lib.wizards, lib.num_wizards);
+	} else {
+		std::ifstream wizard_in(wizard_file);
+		loaded = bool(wizard_in >> lib.num_wizards) && lib.num_wizards >= 0;
+		if (not loaded)
+			std::cout << "Error: could not read " << wizard_file << std::endl;
+		lib.wizards = create_wizards(loaded ? lib.num_wizards : 0);
+		for (int i = 0; loaded && i < lib.num_wizards; i++) {
+			lib.wizards[i] = read_wizard_data(wizard_in);
+		}
+	}
+	unmap_file(wizard_map);
+	if (not loaded)
+		return false;
+	lib.logins = build_login_index(lib.wizards, lib.num_wizards);
+	return true;
+}
+
+/*
+Function: hash_wizard_file
+Description: copies a wizard file with every plain text password replaced by a salted PBKDF2 hash
+	(PASSWORD_ITERATIONS iterations), which loads like any other wizard file but no longer gives the
+	passwords away. passwords that are already hashed are kept as they are. nothing is written unless
+	pbkdf2_known_answers passes
+Parameters: const std::string &wizard_file: the wizard file to read
+			const std::string &hashed_file: the wizard file to write
+Returns: a boolean value, true if the hashed file was written
+*/
+bool hash_wizard_file(const std::string &wizard_file, const std::string &hashed_file) {
+	if (not pbkdf2_known_answers()) {
+		std::cout << "Error: PBKDF2 failed its known answer test, no hashes written." << std::endl;
+		return false;
+	}
+	mapped_file wizard_map = {nullptr, 0, false};
+	wizard* wizards = nullptr;
+	int num_wizards = 0;
+	bool loaded = read_whole_file(wizard_file, wizard_map) && read_mapped_wizards(wizard_map, wizards, num_wizards);
+	unmap_file(wizard_map);
+	if (not loaded) {
+		std::cout << "Error: could not read " << wizard_file << std::endl;
+		delete_wizards(wizards);
+		return false;
+	}
+	hash_passwords(wizards, num_wizards, PASSWORD_ITERATIONS);
+
+	std::ofstream out(hashed_file);
+	output_buffer buffer = create_output_buffer(out);
+	put_int(buffer, num_wizards);
+	put_text(buffer, "\n");
+	for (int i = 0; i < num_wizards; i++) {
+		const wizard &w = wizards[i];
+		std::string password = format_password_hash(w.credential);
+		format_record(buffer, wizard_record{w.name, w.id, password, w.position_title, w.beard_length}, wizard_schema());
+	}
+	flush_output(buffer);
+	delete_wizards(wizards);
+	out.close();
+	if (not out) {
+		std::cout << "Error: could not write " << hashed_file << std::endl;
+		return false;
+	}
+	std::cout << "Hashed " << num_wizards << " passwords into " << hashed_file << std::endl;
+	return true;
+}
+
+/*
+Function: fill_stream
+Description: moves the unparsed bytes of a spellbook stream to the front of its window and reads the file
+	until the window is full. a window that is already full of one unparsed record is doubled first
+Parameters: spellbook_stream &st: the stream
+Returns: a boolean value, false on a read error
+*/
+bool fill_stream(spellbook_stream &st) {
+	std::copy(st.data.begin() + st.begin, st.data.begin() + st.end, st.data.begin());
+	st.end -= st.begin;
+	st.begin = 0;
+	if (st.end == st.data.size())
+		st.data.resize(st.data.size() * 2);
+
+	while (not st.eof && st.end < st.data.size()) {
+		ssize_t n = read(st.fd, st.data.data() + st.end, st.data.size() - st.end);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		st.eof = (n == 0);
+		st.end += n;
+	}
+	return true;
+}
+
+/*
+Function: open_spellbook_stream
+Description: opens a text spellbook file for streaming and reads its spellbook count
+Parameters: const std::string &filename: the spellbook file (snapshots can't be streamed, they are
+				mapped whole anyway)
+			spellbook_stream &st: the stream, close it with close_spellbook_stream
+Returns: a boolean value, true if the file is open and positioned on the first spellbook
+*/
+bool open_spellbook_stream(const std::string &filename, spellbook_stream &st) {
+	st.fd = open(filename.c_str(), O_RDONLY);
+	st.data.assign(STREAM_BLOCK_SIZE, 0);
+	st.begin = 0;
+	st.end = 0;
+	st.eof = false;
+	st.books_left = 0;
+	st.spells_seen = 0;
+	if (st.fd < 0 || not fill_stream(st)) {
+		std::cout << "Error: could not read " << filename << std::endl;
+		return false;
+	}
+
+	if (st.end >= sizeof(SNAPSHOT_MAGIC) && std::equal(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC), st.data.begin())) {
+		std::cout << "Error: streaming needs a text spellbook file, not a snapshot." << std::endl;
+		return false;
+	}
+	token_cursor c = {st.data.data(), st.data.data() + st.end};
+	if (not next_int(c, st.books_left) || st.books_left < 0) {
+		std::cout << "Error: malformed spellbook file." << std::endl;
+		return false;
+	}
+	st.begin = c.pos - st.data.data();
+	return true;
+}
+
+/*
+Function: close_spellbook_stream
+Description: closes a stream opened by open_spellbook_stream and frees its window
+Parameters: spellbook_stream &st: the stream
+*/
+void close_spellbook_stream(spellbook_stream &st) {
+	if (st.fd >= 0)
+		close(st.fd);
+	st.fd = -1;
+	std::vector<char>().swap(st.data);
+}
+
+/*
+Function: read_stream_batch
+Description: parses every complete spellbook record in the stream's window (reading more of the file
+	first) into a small catalog whose string pool is the window itself. a record only counts as complete
+	if whitespace or the end of the file follows it, since the window may end in the middle of a token.
+	only a record that reaches the end of the window is read again with more of the file, one that fails
+	before it is malformed, so bad input can't grow the window
+Parameters: spellbook_stream &st: the stream, moved past the batch
+			catalog &batch: filled with the batch, release it with release_catalog before the next call
+Returns: a boolean value, false if the file is malformed or can't be read
+*/
+bool read_stream_batch(spellbook_stream &st, catalog &batch) {
+	std::vector<catalog_builder> parts(1);
+	catalog_builder &b = parts[0];
+	b.effects = create_effect_table();
+	if (not fill_stream(st))
+		return false;
+
+	while (st.books_left > 0) {
+		const char* window_end = st.data.data() + st.end;
+		token_cursor c = {st.data.data() + st.begin, window_end};
+		std::size_t books_before = b.spellbooks.size();
+		std::size_t spells_before = b.names.size();
+		bool parsed = read_mapped_spellbook(c, st.data.data(), b);
+		if (parsed && (c.pos < window_end || st.eof)) {
+			st.begin = c.pos - st.data.data();
+			st.books_left--;
+			continue;
+		}
+
+		//the record runs past the window: drop what was read of it and hand out the batch, or read
+		//further if it is the only record left in the window
+		b.spellbooks.resize(books_before);
+		b.names.resize(spells_before);
+		b.success_rates.resize(spells_before);
+		b.effect_ids.resize(spells_before);
+		if (st.eof || (not parsed && c.pos < window_end)) {
+			std::cout << "Error: malformed spellbook file." << std::endl;
+			return false;
+		}
+		if (not b.spellbooks.empty())
+			break;
+		if (not fill_stream(st))
+			return false;
+	}
+
+	finish_catalog(parts, st.data.data(), batch);
+	return true;
+}
+
+/*
+Function: stream_catalog
+Description: the single pass behind every streaming query. reads the spellbook file a batch at a time and
+	hands each batch to visit, so memory stays around one window whatever the size of the file
+Parameters: const std::string &spellbook_file: the spellbook file
+			visit: called as visit(const catalog &batch, long long first_spell) for each batch in file
+				order, first_spell being the file-wide index of the batch's first spell
+Returns: a boolean value, true if the whole file was read
+*/
+template <typename visitor>
+bool stream_catalog(const std::string &spellbook_file, visitor visit) {
+	spellbook_stream st;
+	bool ok = open_spellbook_stream(spellbook_file, st);
+	while (ok && st.books_left > 0) {
+		catalog batch = {};
+		ok = read_stream_batch(st, batch);
+		if (ok)
+			visit(static_cast<const catalog&>(batch), st.spells_seen);
+		st.spells_seen += batch.num_spells;
+		release_catalog(batch);
 	}
-	sb.avg_success_rate = mean/sb.num_spells;
-	return sb;
+	close_spellbook_stream(st);
+	return ok;
 }
 
 /*
- * Function: delete_spells
- * Description: Deletes a given dynamic array of spells and updates its pointer
- * 		to be nullptr.
- * Parameters:
- * 		spells (spell*&): A reference to the pointer that points to the dynamic
- * 			array of spells to be deleted.
- * Post-conditions: 1. Dynamic array of spells should be deleted. 2. spells
- * 		pointer parameter should be set to nullptr. Since this parameter is
- * 		passed by reference, the corresponding argument will be set to nullptr
- * 		as well.
- */
-void delete_spells(spell*& spells) {
-	delete[] spells;
-	spells = nullptr;}
+Function: stream_all_spellbooks
+Description: streaming counterpart of write_all_spellbooks
+Parameters: output_buffer &buffer: where to write
+			const std::string &spellbook_file: the spellbook file
+			const session &s: the logged-in wizard's session (only its role is used)
+Returns: a boolean value, true if the whole file was read
+*/
+bool stream_all_spellbooks(output_buffer &buffer, const std::string &spellbook_file, const session &s) {
+	spell_mask visible;
+	return stream_catalog(spellbook_file, [&](const catalog &batch, long long) {
+		build_visibility_mask(batch, ROLES[s.role].restricted, ROLES[s.role].num_restricted, visible);
+		for (int i = 0; i < batch.num_spellbooks; i++) {
+			write_spellbook(buffer, batch, batch.spellbooks[i], visible);
+		}
+	});
+}
 
 /*
- * Function: delete_spellbooks
- * Description: Deletes all of the dynamic memory associated with the given
- * 		array of spellbooks, including the arrays of spells inside each
- * 		spellbook. The size parameter indicates the size of the array of
- * 		spellbooks.
- * Parameters:
- * 		spellbooks (spellbook*&): A reference to the pointer that points to the
- * 			dynamic array of spellbooks to be deleted
- * Post-conditions: 1. Dynamic arrays of spells within each spellbook should
- * 		be deleted (see hint). 2. Dynamic array of spellbooks should be deleted.
- * 		3. spellbooks pointer parameter should be set to nullptr. Since this
- * 		parameter is passed by reference, the corresponding argument will be set
- * 		to nullptr as well.
- */
-void delete_spellbooks(spellbook*& spellbooks, int size) {
-	for (int i = 0; i < size; i++) {
-        delete_spells(spellbooks[i].spells);
-    }
-    delete[] spellbooks;
-    spellbooks = nullptr;
+Function: stream_effect_search
+Description: streaming counterpart of write_effect_search, scans the effect column of each batch
+Parameters: output_buffer &buffer: where to write
+			const std::string &spellbook_file: the spellbook file
+			int effect: id of one of the known effects (the same in every batch)
+Returns: a boolean value, true if the whole file was read
+*/
+bool stream_effect_search(output_buffer &buffer, const std::string &spellbook_file, int effect) {
+	return stream_catalog(spellbook_file, [&](const catalog &batch, long long) {
+		for (int b = 0; b < batch.num_spellbooks; b++) {
+			const spellbook &sb = batch.spellbooks[b];
+			for (int i = sb.spell_begin; i < sb.spell_end; i++) {
+				if (batch.effect_ids[i] != effect)
+					continue;
+				put_text(buffer, "Spellbook: ");
+				put_text(buffer, pool_view(batch, sb.title));
+				put_text(buffer, "\nSpell: ");
+				write_spell(buffer, batch, i);
+			}
+		}
+	});
 }
 
+/*
+Function: stream_ranking
+Description: streaming counterpart of write_ranking for the best top_k spells, kept in a heap of at most
+	top_k entries whose root is the worst of them
+Parameters: output_buffer &buffer: where to write
+			const std::string &spellbook_file: the spellbook file
+			const session &s: the logged-in wizard's session (only its role is used)
+			int top_k: number of best spells to write, at least 1
+Returns: a boolean value, true if the whole file was read
+*/
+bool stream_ranking(output_buffer &buffer, const std::string &spellbook_file, const session &s, int top_k) {
+	scoped_timer timer(STAT_RANKING);
+	std::size_t start = buffered_bytes(buffer);
+	auto ranks_before = [](const ranked_spell &a, const ranked_spell &b) {
+		return a.success_rate > b.success_rate || (a.success_rate == b.success_rate && a.spell < b.spell);
+	};
+	std::vector<ranked_spell> best;
+	best.reserve(top_k + 1);
+	spell_mask visible;
+
+	bool ok = stream_catalog(spellbook_file, [&](const catalog &batch, long long first_spell) {
+		build_visibility_mask(batch, ROLES[s.role].restricted, ROLES[s.role].num_restricted, visible);
+		for (int i = 0; i < batch.num_spells; i++) {
+			ranked_spell candidate = {batch.success_rates[i], first_spell + i, "", ""};
+			if (not spell_visible(visible, i) || ((int)best.size() == top_k && not ranks_before(candidate, best.front())))
+				continue;
+			candidate.name = pool_view(batch, batch.names[i]);
+			candidate.effect = batch.effects.names[batch.effect_ids[i]];
+			best.push_back(std::move(candidate));
+			std::push_heap(best.begin(), best.end(), ranks_before);
+			if ((int)best.size() > top_k) {
+				std::pop_heap(best.begin(), best.end(), ranks_before);
+				best.pop_back();
+			}
+		}
+	});
+
+	std::sort_heap(best.begin(), best.end(), ranks_before);
+	for (const ranked_spell &spell : best) {
+		put_text(buffer, spell.name);
+		put_text(buffer, " ");
+		put_float(buffer, spell.success_rate);
+		put_text(buffer, " ");
+		put_text(buffer, spell.effect);
+		put_text(buffer, "\n");
+	}
+	timer.bytes = buffered_bytes(buffer) - start;
+	return ok;
+}
 
 /*
-Function: create_wizards
-Description: allocates a dynamic array of wizardss of the requested size
- * 		and returns a pointer that points to it.
-Parameters: size (int): Size of dynamic array of wizards to create
-Returns: Pointer that points to dynamically allocated array of wizards
+Function: run_stream_query
+Description: streaming counterpart of run_query, for catalogs too big to load. every query is one pass
+	over the spellbook file. supports login, display, effect, rank <k> (k is required, only the best k
+	are kept), export <file> [effect] and stats. name isn't available, an exact title match can't be
+	told apart from prefix matches until the end of the file
+Parameters: const library &lib: the wizards, lib.spellbook_file names the spellbook file
+			session &s: the script's session, changed by login
+			const std::string &line: the command line
+			output_buffer &buffer: where to write the results
+Returns: a boolean value, false if the command failed (an error line is written)
 */
-wizard* create_wizards(int size) {
-	return new wizard[size];
+bool run_stream_query(const library &lib, session &s, const std::string &line, output_buffer &buffer) {
+	std::istringstream args(line);
+	std::string command;
+	command_result answered = run_session_command(lib, s, args, command, buffer);
+	if (answered != COMMAND_QUERY)
+		return answered == COMMAND_OK;
+
+	//the known effects have the same ids in every batch
+	intern_table known = create_effect_table();
+	std::string text;
+	int top_k = 0;
+	if (command == "display") {
+		scoped_timer timer(STAT_DISPLAY_ALL);
+		std::size_t start = buffered_bytes(buffer);
+		bool ok = stream_all_spellbooks(buffer, lib.spellbook_file, s);
+		timer.bytes = buffered_bytes(buffer) - start;
+		return ok;
+	} else if (command == "effect" && args >> text) {
+		int effect = find_string(known, text);
+		if (not effect_allowed(s, effect)) {
+			put_text(buffer, "Error: Invalid spell effect\n");
+			return false;
+		}
+		scoped_timer timer(STAT_EFFECT_SEARCH);
+		std::size_t start = buffered_bytes(buffer);
+		bool ok = stream_effect_search(buffer, lib.spellbook_file, effect);
+		timer.bytes = buffered_bytes(buffer) - start;
+		return ok;
+	} else if (command == "rank" && args >> top_k && top_k > 0) {
+		return stream_ranking(buffer, lib.spellbook_file, s, top_k);
+	} else if (command == "rank") {
+		put_text(buffer, "Error: streaming rank needs a count, e.g. rank 10\n");
+		return false;
+	} else if (command == "export" && args >> text) {
+		std::string effect_name;
+		int effect = -1;
+		if (args >> effect_name) {
+			effect = find_string(known, effect_name);
+			if (not effect_allowed(s, effect)) {
+				put_text(buffer, "Error: Invalid spell effect\n");
+				return false;
+			}
+		}
+
+		scoped_timer timer(STAT_EXPORT);
+		std::ofstream outfile(text);
+		if (not outfile) {
+			put_text(buffer, "Error: could not open " + text + "\n");
+			return false;
+		}
+		output_buffer file_buffer = create_output_buffer(outfile);
+		bool ok = effect >= 0 ? stream_effect_search(file_buffer, lib.spellbook_file, effect) :
+			stream_all_spellbooks(file_buffer, lib.spellbook_file, s);
+		flush_output(file_buffer);
+		timer.bytes = file_buffer.bytes_written;
+		if (ok)
+			put_text(buffer, "Saved to file!\n");
+		return ok;
+	}
+	put_text(buffer, "Error: unknown or incomplete command: " + line + "\n");
+	return false;
 }
 
 /*
-Function: read_wizard_data
-Description: reads in wizard data from the user-given file and creates a wizards
- * 		data structure with each line 
-Parameters: user given file
-Returns: the newly-made wizard object 
+Function: run_stream
+Description: streaming mode. like run_batch, but the spellbooks are never loaded: each query reads the
+	spellbook file once with bounded memory (see run_stream_query)
+Parameters: const std::string &wizard_file: user given wizard info file
+			const std::string &spellbook_file: user given (text) spellbook file
+			const std::string &query_file: the query script, "-" to read it from std::cin
+Returns: exit status for main, 0 if every query succeeded and 1 if not
 */
-wizard read_wizard_data(std::ifstream &file) {
-	wizard w;
-	file >> w.name >> w.id >> w.password >> w.position_title >> w.beard_length;
-	return w;
+int run_stream(const std::string &wizard_file, const std::string &spellbook_file, const std::string &query_file) {
+	library lib = {};
+	lib.spellbook_file = spellbook_file;
+	if (not load_wizards(wizard_file, lib)) {
+		release_library(lib);
+		return 1;
+	}
+	int status = run_script(query_file, [&lib](session &s, const std::string &line, output_buffer &buffer) {
+		return run_stream_query(lib, s, line, buffer);
+	});
+	release_library(lib);
+	return status;
 }
 
 /*
-Function: delete_wizards
-Description: deletes all of the dynamic memory associated with the given
- * 		array of wizards. The size parameter indicates the size of the array of
- * 		wizards.
-Parameters: wizard (wizards*&): A reference to the pointer that points to the dynamic
- * 			array of wizards to be deleted.
+Function: stop_server
+Description: SIGINT/SIGTERM handler of the query server, asks the accept loop to shut down
+Parameters: int: the signal (unused)
 */
-void delete_wizards(wizard*& wizards) {
-	delete[] wizards;
-	wizards = nullptr;
+void stop_server(int) {
+	server_stopping = 1;
 }
 
 /*
-Function: login_verification
-Description: iterates through the user-given wizards file to see if the user login matches
-Parameters: const wizard* wizards: pointer to the wizards dynamic array
-			int num_wizards: number of wizards found in the user given wizards file
-			int id: user given id 
-			const std::string &password: user given password
-			wizard& current_user: reference to the wizard object currently logged in
-Returns: a boolean value (true if the match is found, false if not)
+Function: answer_requests
+Description: answers the request lines a client has sent so far. every line is run with run_query in the
+	client's own session, and its output is followed by an "OK" or "ERROR" line so the client knows where
+	each answer ends. closes the client if it has hung up and nothing is left to answer. the session only
+	holds a spellbook version while its lines are being answered
+Parameters: const library &lib: the shared, read-only library
+			request_queue &queue: the queue the client came from, whose lock guards its lines
+			client_connection &client: the client, marked busy by the accept loop
 */
-bool login_verification(const wizard* wizards, int num_wizards, int id, const std::string &password, wizard& current_user) {
-	for (int i = 0; i < num_wizards; i++) {
-		if ((wizards[i].id == id) && (wizards[i].password == password)) {
-			current_user = wizards[i];
-			return true;
+void answer_requests(const library &lib, request_queue &queue, client_connection &client) {
+	output_buffer buffer = create_socket_buffer(client.fd);
+	while (true) {
+		std::deque<std::string> lines;
+		{
+			std::lock_guard<std::mutex> guard(queue.lock);
+			if (client.lines.empty()) {
+				client.busy = false;
+				if (client.closed)
+					close(client.fd);
+				return;
+			}
+			lines.swap(client.lines);
+		}
+
+		//answer every line, then send all the answers at once
+		for (const std::string &line : lines) {
+			bool ok = run_query(lib, client.s, line, buffer, false);
+			if (not ok)
+				count_event(COUNTER_FAILED_QUERIES);
+			put_text(buffer, ok ? "OK\n" : "ERROR\n");
 		}
+		flush_output(buffer);
+
+		//let go of the spellbooks between batches so an idle client doesn't keep an old version alive, the
+		//next query picks up the current one (see refresh_session)
+		client.s.version = nullptr;
+		client.s.view = nullptr;
 	}
-	return false;
 }
 
 /*
-Function: display_spellbook_info
-Description: pretty self explanatory, displays all the attributes of a spellbook to the terminal. filters
-	out 'death' and 'poison' spells if the logged-in user is a student
-Parameters: const spellbook &sb: refernce to the spellbook object being printed
-			bool is_student: true if the user's wizard.position_title is student, and false if not
+Function: server_worker
+Description: one thread of the query server's worker pool, answers queued clients until it is handed nullptr
+Parameters: const library &lib: the shared, read-only library
+			request_queue &queue: clients with request lines to answer
 */
-void display_spellbook_info(const spellbook &sb, bool is_student) {
-	std::cout << "Spellbook: " << sb.title << std::endl;
-	std::cout << "Author: " << sb.author << std::endl;
-	std::cout << "Pages: " << sb.num_pages << std::endl;
-	std::cout << "Edition: " << sb.edition << std::endl;
-	std::cout << "Average Success Rate: " << sb.avg_success_rate << std::endl;
-	
-	std::cout << "Spells: " << std::endl;
-	for (int i = 0; i < sb.num_spells; i++) {
-		if (is_student && (sb.spells[i].effect == "death" || sb.spells[i].effect == "poison"))
-			//don't print poison or death spells if the user is a student
-			continue;
-		
-		std::cout << sb.spells[i].name << " " << sb.spells[i].success_rate << " " << sb.spells[i].effect << std::endl;
+void server_worker(const library &lib, request_queue &queue) {
+	while (true) {
+		std::shared_ptr<client_connection> client;
+		{
+			std::unique_lock<std::mutex> guard(queue.lock);
+			queue.ready.wait(guard, [&queue]() { return not queue.clients.empty(); });
+			client = queue.clients.front();
+			queue.clients.pop_front();
+		}
+		if (client == nullptr)
+			return;
+		answer_requests(lib, queue, *client);
 	}
 }
 
 /*
-Function: spellbook_to_file
-Description: saves the spellbook data to file, similar to the previous function. filters out 'death'
-	and 'poison' spells if the logged in user is a student
-Parameters: std::ofstream &outfile: user given name of the file to save information to
-			const spellbook &sb: refernce to the current spellbook object
-			bool is_student: boolean value, true if the logged in user is a student and false if not
-*/
-void spellbook_to_file(std::ofstream &outfile, const spellbook &sb, bool is_student) {
-	outfile << "Spellbook: " << sb.title << std::endl;
-	outfile << "Author: " << sb.author << std::endl;
-	outfile << "Pages: " << sb.num_pages << std::endl;
-	outfile << "Edition: " << sb.edition << std::endl;
-	outfile << "Average Success Rate: " << sb.avg_success_rate << std::endl;
-	
-	outfile << "Spells: " << std::endl;
-	for (int i = 0; i < sb.num_spells; i++) {
-		if (is_student && (sb.spells[i].effect == "death" || sb.spells[i].effect == "poison"))
-			continue;
-		
-		outfile << sb.spells[i].name << " " << sb.spells[i].success_rate << " " << sb.spells[i].effect << std::endl;
+Function: read_client
+Description: reads what a client has sent without blocking, and hands its complete request lines to the
+	worker pool. a client that hangs up, fails or sends an overlong line is marked closed, and the last
+	worker to answer it (or this function, if none is) closes it
+Parameters: request_queue &queue: the worker pool's queue
+			const std::shared_ptr<client_connection> &client: the client, its socket is readable
+Returns: a boolean value, false if the accept loop should stop polling the client
+*/
+bool read_client(request_queue &queue, const std::shared_ptr<client_connection> &client) {
+	char chunk[4096];
+	ssize_t n = recv(client->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return true;
+
+	std::deque<std::string> lines;
+	if (n > 0) {
+		client->pending.append(chunk, n);
+		std::size_t start = 0;
+		std::size_t end;
+		while ((end = client->pending.find('\n', start)) != std::string::npos) {
+			std::string line = client->pending.substr(start, end - start);
+			if (not line.empty() && line.back() == '\r')
+				line.pop_back();
+			lines.push_back(std::move(line));
+			start = end + 1;
+		}
+		client->pending.erase(0, start);
 	}
+	bool hung_up = n <= 0 || client->pending.size() > MAX_REQUEST_LINE;
+
+	std::lock_guard<std::mutex> guard(queue.lock);
+	for (std::string &line : lines)
+		client->lines.push_back(std::move(line));
+	client->closed = hung_up;
+	if (not client->busy && not client->lines.empty()) {
+		client->busy = true;
+		queue.clients.push_back(client);
+		queue.ready.notify_one();
+	} else if (not client->busy && hung_up) {
+		close(client->fd);
+	}
+	return not hung_up;
 }
 
 /*
-Function: input_files
-Description: 
-Parameters: std::string &wizard_file: reference to the user given file with wizard info
-			std::string &spellbook_file: reference to the user given spellbook info file
-Returns: a boolean value, true if the file uploads works, false if not
+Function: open_server_socket
+Description: creates the query server's listening Unix domain socket, replacing a stale socket file
+Parameters: const std::string &socket_path: file system path of the socket
+			int &listen_fd: set to the listening socket
+Returns: a boolean value, true if the socket is listening
 */
-bool input_files(std::string &wizard_file, std::string &spellbook_file) {
-	std::cout << "Enter the wizard info file name: ";
-    if (not (std::cin >> wizard_file)) return false;
-    
-    std::cout << "Enter the spellbook info file name: ";
-    if (not (std::cin >> spellbook_file)) return false;
-    
-    return true;
+bool open_server_socket(const std::string &socket_path, int &listen_fd) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path)) {
+		std::cout << "Error: socket path too long." << std::endl;
+		return false;
+	}
+	std::copy(socket_path.begin(), socket_path.end(), addr.sun_path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		std::cout << "Error: could not create socket." << std::endl;
+		return false;
+	}
+	unlink(socket_path.c_str());
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 128) != 0) {
+		std::cout << "Error: could not listen on " << socket_path << std::endl;
+		close(listen_fd);
+		return false;
+	}
+	return true;
 }
 
 /*
-Function: open_files
-Description: opens the user given files and saves them to a reference variable
-Parameters: const std::string &wizard_file: reference to the user given wizard info file
-			const std::string &spellbook_file: reference to the user given spellbook info file
-			std::ifstream &wizard_in: variable holding the wizard input file
-			std::ifstream &spellbook_in: variable holding the wpellbook input file
-REturns: a boolean value, true if the file accessing works, false if not
+Function: run_server
+Description: daemon mode. serves login and query requests (the commands of run_query, except export) from
+	many clients at once over a Unix domain socket. one thread polls the listening socket and every client
+	and hands complete request lines to a fixed pool of worker threads sharing the one loaded library, so
+	idle clients don't hold a worker. runs until SIGINT or SIGTERM, or until polling fails
+Parameters: library &lib: the loaded library, only written by the watcher
+			const std::string &socket_path: file system path of the socket
+			int num_workers: size of the worker pool
+			file_watch &watch: stop flag of the spellbook watcher
+			std::thread &watcher: set to the watch_spellbooks thread when lib.watching, started with the
+				shutdown signals blocked like the workers, and left for main to stop
+Returns: exit status for main, 1 if the server couldn't start or polling failed
 */
-bool open_files(const std::string &wizard_file, const std::string &spellbook_file, 
-				std::ifstream &wizard_in, std::ifstream &spellbook_in) {
-	wizard_in.open(wizard_file);
-	spellbook_in.open(spellbook_file);
-	
-	if (not wizard_in || not spellbook_in) {
-		std::cout << "Error: file names not found or accessing error." << std::endl;
-		return false;
+int run_server(library &lib, const std::string &socket_path, int num_workers, file_watch &watch, std::thread &watcher) {
+	int listen_fd;
+	if (not open_server_socket(socket_path, listen_fd))
+		return 1;
+
+	//the shutdown signals stay blocked everywhere except inside the ppoll below, so a signal can't slip in
+	//between checking server_stopping and waiting
+	struct sigaction action = {};
+	action.sa_handler = stop_server;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	sigset_t stop_signals, old_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+	if (lib.watching)
+		watcher = std::thread(watch_spellbooks, std::ref(lib), std::ref(watch));
+	request_queue queue;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < num_workers; i++) {
+		workers.emplace_back(server_worker, std::cref(lib), std::ref(queue));
 	}
-	return true;
+	std::cout << "Serving on " << socket_path << " with " << num_workers << " workers" << std::endl;
+
+	//polls[0] is the listening socket, polls[i] is clients[i - 1]
+	std::vector<pollfd> polls = {{listen_fd, POLLIN, 0}};
+	std::vector<std::shared_ptr<client_connection>> clients;
+	int status = 0;
+	while (not server_stopping) {
+		if (ppoll(polls.data(), polls.size(), nullptr, &old_mask) < 0) {
+			if (errno == EINTR)
+				continue; // a shutdown signal
+			std::cout << "Error: poll failed: " << std::strerror(errno) << std::endl;
+			status = 1;
+			break;
+		}
+
+		for (std::size_t i = polls.size() - 1; i > 0; i--) {
+			if (polls[i].revents == 0 || read_client(queue, clients[i - 1]))
+				continue;
+			polls[i] = polls.back();
+			polls.pop_back();
+			clients[i - 1] = clients.back();
+			clients.pop_back();
+		}
+
+		if (polls[0].revents & POLLIN) {
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd < 0)
+				continue; // a client that gave up
+			timeval timeout = {CLIENT_SEND_TIMEOUT_SECONDS, 0};
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			count_event(COUNTER_CONNECTIONS);
+			clients.push_back(std::make_shared<client_connection>());
+			*clients.back() = {fd, {nullptr, 0, nullptr, nullptr}, "", {}, false, false};
+			polls.push_back({fd, POLLIN, 0});
+		}
+	}
+
+	//stop reading, let the workers answer the lines they already have, then stop them
+	close(listen_fd);
+	for (const std::shared_ptr<client_connection> &client : clients)
+		shutdown(client->fd, SHUT_RD);
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		for (int i = 0; i < num_workers; i++)
+			queue.clients.push_back(nullptr);
+		queue.ready.notify_all();
+	}
+	for (std::thread &w : workers) w.join();
+	for (const std::shared_ptr<client_connection> &client : clients)
+		close(client->fd);
+	pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	unlink(socket_path.c_str());
+	std::cout << "Server stopped." << std::endl;
+	return status;
 }
 
 /*
-Function: read_in_data
-Description: reads in spellbook and wizards data from the user given files and creates a pointer to 
-	the respective dynamic arrays created. 
-Parameters: std::ifstream& wizard_in: reference to the user given wizard file
-			std::ifstream& spellbook_in: reference to the user given spellbook file 
-			wizard*& wizards: pointer to the created wizards object
-			spellbook*& spellbooks: pointer to the created spellbook object
-			int& num_wizards: integer found in the beginning of the file with the number of wizards 
-			int& num_spellbooks: integer found in the beginning of the file with the number of spellbooks 
-Returns: a boolean value depending on if the reading was a success
+Function: next_random
+Description: splitmix64, a small fast generator so generated catalogs are the same on every machine
+Parameters: std::uint64_t &state: the generator's state, advanced
+Returns: the next 64 random bits
 */
-bool read_in_data(std::ifstream& wizard_in, std::ifstream& spellbook_in, wizard*& wizards, 
-					spellbook*& spellbooks, int& num_wizards, int& num_spellbooks){
-	wizard_in >> num_wizards;
-	wizards = create_wizards(num_wizards);
+std::uint64_t next_random(std::uint64_t &state) {
+	std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/*
+Function: generate_catalog
+Description: writes synthetic wizard and spellbook files in the usual formats, for benchmarking. books
+	have between 1 and twice spells_per_book - 1 spells, effects follow GENERATED_EFFECT_WEIGHTS and about
+	half of the wizards are students. wizard i logs in with id 100000 + i and password pw<i>
+Parameters: const std::string &wizard_file: name of the wizard file to write
+			const std::string &spellbook_file: name of the spellbook file to write
+			int num_spellbooks: number of spellbooks to generate
+			int spells_per_book: average number of spells per spellbook
+Returns: a boolean value, true if both files were written
+*/
+bool generate_catalog(const std::string &wizard_file, const std::string &spellbook_file, int num_spellbooks,
+					int spells_per_book) {
+	std::ofstream wizard_out(wizard_file);
+	std::ofstream spellbook_out(spellbook_file);
+	if (not wizard_out || not spellbook_out) {
+		std::cout << "Error: could not create " << wizard_file << " or " << spellbook_file << std::endl;
+		return false;
+	}
+	std::uint64_t state = 20240611;
+
+	const char* const positions[] = {"Student", "Student", "Teacher", "Headmaster"};
+	int num_wizards = std::max(20, num_spellbooks / 100);
+	output_buffer buffer = create_output_buffer(wizard_out);
+	put_int(buffer, num_wizards);
+	put_text(buffer, "\n");
 	for (int i = 0; i < num_wizards; i++) {
-		wizards[i] = read_wizard_data(wizard_in);
+		std::string name = "Wizard_" + std::to_string(i);
+		std::string password = "pw" + std::to_string(i);
+		const char* position = positions[next_random(state) % 4];
+		float beard_length = next_random(state) % 200;
+		format_record(buffer, wizard_record{name, 100000 + i, password, position, beard_length}, wizard_schema());
 	}
+	flush_output(buffer);
 
-	spellbook_in >> num_spellbooks; 
-	spellbooks = create_spellbooks(num_spellbooks);
+	int num_words = sizeof(GENERATED_TITLE_WORDS) / sizeof(GENERATED_TITLE_WORDS[0]);
+	int num_authors = std::max(1, num_spellbooks / 20);
+	buffer = create_output_buffer(spellbook_out);
+	put_int(buffer, num_spellbooks);
+	put_text(buffer, "\n");
 	for (int i = 0; i < num_spellbooks; i++) {
-		spellbooks[i] = read_spellbook_data(spellbook_in);
+		spellbook_record book;
+		book.num_spells = 1 + next_random(state) % std::max(1, 2 * spells_per_book - 1);
+		std::string title = GENERATED_TITLE_WORDS[next_random(state) % num_words] + std::string("_Tome_") +
+			std::to_string(i);
+		std::string author = "Author_" + std::to_string(next_random(state) % num_authors);
+		book.title = title;
+		book.author = author;
+		book.num_pages = 50 + next_random(state) % 2000;
+		book.edition = 1 + next_random(state) % 30;
+		format_record(buffer, book, spellbook_schema());
+
+		for (int k = 0; k < book.num_spells; k++) {
+			int pick = next_random(state) % 100;
+			int effect = 0;
+			while (pick >= GENERATED_EFFECT_WEIGHTS[effect]) {
+				pick -= GENERATED_EFFECT_WEIGHTS[effect];
+				effect++;
+			}
+			std::string name = "Spell_" + std::to_string(i) + "_" + std::to_string(k);
+			float success_rate = (next_random(state) % 10001) / 100.0f;
+			format_record(buffer, spell_record{name, success_rate, GENERATED_EFFECTS[effect]}, spell_schema());
+		}
 	}
-	return true;
+	flush_output(buffer);
+
+	std::cout << "Generated " << num_wizards << " wizards and " << num_spellbooks << " spellbooks" << std::endl;
+	return wizard_out.good() && spellbook_out.good();
 }
 
 /*
-Function: user_login
-Description: takes the uder given ID and password, sends them to login_verification() to find a match, and 
-	prints the information of the logged in user to the terminal
-Parameters: const wizard* wizards: pointer for the wizards dynamic array
-			int num_wizards: read in from the first line of the user given wizards file
-			wizard& current_user: reference to the wizard currently logged in
+Function: elapsed_us
+Description: microseconds since a steady_clock reading
+Parameters: std::chrono::steady_clock::time_point start: the earlier reading
+Returns: the elapsed time in microseconds
 */
-bool user_login(const wizard* wizards, int num_wizards, wizard& current_user) {
-    int login_attempts = 0;
-    bool logged_in = false;
-    
-	//let the user try to login three times
-    while (not logged_in && login_attempts < 3) {
-        int id;
-        std::string password;
-        std::cout << "Please enter your ID: ";
-        std::cin >> id;
-        std::cout << "Please enter your password: ";
-        std::cin >> password;
-        
-		//if verification returns true, print info to terminal
-        if (login_verification(wizards, num_wizards, id, password, current_user)) {
-            logged_in = true;
-            std::cout << "Welcome, " << current_user.name << "!" << std::endl;
-        	std::cout << "ID: " << current_user.id  << std::endl;
-            std::cout << "Status: " << current_user.position_title << std::endl;
-            std::cout << "Beard Length: " << current_user.beard_length << std::endl;
-			return true;
-		} else {
-			//let the user try to login again if verification returns false
-            login_attempts++;
-			std::cout << "Incorrect id or password. Attempts remaining: " << login_attempts << std::endl;
-        }
-    }
-	//end program when theres more than three attempts
-	std::cout << "Too many failed login attempts." << std::endl;
-	return false;
+double elapsed_us(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
 }
 
 /*
-Function: display_selection_effect
-Description: search and display function for 'search by effect', filtering 'death' and 'poison' out for students. 
-	saves to file or prints to screen depending on user input 
-Parameters: spellbook* spellbooks: pointer to the spellbook dynamic array
-			int num_spellbooks: # of spellbooks from user given file
-			std::string effect: effect to search for 
-			bool is_student: true if student, false if not
+Function: report_timings
+Description: prints one line of benchmark results: how many operations ran, their throughput and their
+	latency percentiles, plus output bandwidth for the operations that write
+Parameters: const std::string &name: what was measured
+			std::vector<double> &micros: how long each operation took, sorted in place
+			std::size_t bytes: total bytes the operations wrote, 0 if they don't write
 */
-void display_selection_effect(spellbook* spellbooks, int num_spellbooks, std::string effect, bool is_student) {
-    int display_choice;
-    do {
-        std::cout << "How would you like the information displayed?" << std::endl;
-        std::cout << "1. Print to screen" << std::endl;
-        std::cout << "2. Print to file" << std::endl;
-        std::cout << "Your Choice: ";
-        std::cin >> display_choice;
-    } while (display_choice != 1 && display_choice != 2);
+void report_timings(const std::string &name, std::vector<double> &micros, std::size_t bytes) {
+	if (micros.empty())
+		return;
+	std::sort(micros.begin(), micros.end());
+	double total = 0;
+	for (double t : micros) total += t;
+	auto percentile = [&micros](double p) { return micros[std::min(micros.size() - 1, (std::size_t)(p * micros.size()))]; };
 
-    // print spells with the user-chosen effect
-    if (display_choice == 1) {
-        // print to screen
-        for (int i = 0; i < num_spellbooks; i++) {
-            for (int j = 0; j < spellbooks[i].num_spells; j++) {
-                if (spellbooks[i].spells[j].effect == effect) {
-                    if (!(is_student && (effect == "death" || effect == "poison"))) {
-                        std::cout << "Spellbook: " << spellbooks[i].title << std::endl;
-                        std::cout << "Spell: " << spellbooks[i].spells[j].name 
-                                  << " " << spellbooks[i].spells[j].success_rate 
-                                  << " " << spellbooks[i].spells[j].effect 
-                                  << std::endl;
-                    }
-                }
-            }
-        }
-    } else {
-        // save to user given file
-        std::string filename;
-        std::cout << "Please enter filename: ";
-        std::cin >> filename;
-        
-        std::ofstream outfile(filename);
-        for (int i = 0; i < num_spellbooks; i++) {
-            for (int j = 0; j < spellbooks[i].num_spells; j++) {
-                if (spellbooks[i].spells[j].effect == effect) {
-                    if (!(is_student && (effect == "death" || effect == "poison"))) {
-                        outfile << "Spellbook: " << spellbooks[i].title << std::endl;
-                        outfile << "Spell: " << spellbooks[i].spells[j].name 
-                                << " " << spellbooks[i].spells[j].success_rate 
-                                << " " << spellbooks[i].spells[j].effect 
-                                << std::endl;
-                    }
-                }
-            }
-        }
-        outfile.close();
-        std::cout << "Saved to file!" << std::endl;
-    }
+	std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(9) << micros.size() << " ops " << std::setw(12) << micros.size() / (total / 1e6) << " ops/s"
+		<< "  p50 " << percentile(0.5) << "us  p90 " << percentile(0.9) << "us  p99 " << percentile(0.99)
+		<< "us  max " << micros.back() << "us";
+	if (bytes > 0)
+		std::cout << "  " << bytes / total << " MB/s";
+	std::cout << std::defaultfloat << std::endl;
 }
 
 /*
-Function: display_selection_avg_success
-Description: sorts spells and either prints it to terminal or saves to user given file
-Parameters: spellbook* spellbooks: pointer to the spellbook dynamic array
-			int num_spellbooks: from user given spellbooks file
-			bool is_student: true if the user is a student, false if not
+Function: run_bench
+Description: benchmark mode. times loading the given files, then logins, title searches, effect searches,
+	ranking, display all and file exports against the loaded library, and reports each with report_timings.
+	query output goes to a stream that discards it, so only formatting is measured, except for the exports
+	which really write files next to the spellbook file (and remove them): one file, then hash shards
+Parameters: const std::string &wizard_file: wizard file, e.g. from generate_catalog
+			const std::string &spellbook_file: spellbook file or snapshot
+			int iterations: how many times the slower operations are repeated
+Returns: exit status for main
 */
-void display_selection_avg_success(spellbook* spellbooks, int num_spellbooks, bool is_student) {
-    int total_spells = 0;
+int run_bench(const std::string &wizard_file, const std::string &spellbook_file, int iterations) {
+	library lib = {};
+	std::vector<double> micros;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (not load_library(wizard_file, spellbook_file, lib)) {
+		release_library(lib);
+		return 1;
+	}
+	micros.push_back(elapsed_us(start));
+	struct stat st = {};
+	stat(spellbook_file.c_str(), &st);
+	const catalog &cat = lib.spellbooks->cat;
+	std::cout << lib.num_wizards << " wizards, " << cat.num_spellbooks << " spellbooks, " << cat.num_spells
+		<< " spells" << std::endl;
+	report_timings("load", micros, st.st_size);
 
-    // count total spells
-    for (int i = 0; i < num_spellbooks; i++) {
-        total_spells += spellbooks[i].num_spells;
-    }
+	//a session per role, logged in as the first wizard found with it
+	std::vector<session> sessions;
+	for (int r = 0; r < NUM_ROLES; r++) {
+		for (int i = 0; i < lib.num_wizards; i++) {
+			if (find_role(lib.wizards[i].position_title) == r) {
+				sessions.push_back({nullptr, 0, nullptr, nullptr});
+				start_session(lib, lib.wizards[i], sessions.back());
+				break;
+			}
+		}
+	}
+	if (lib.num_wizards == 0 || cat.num_spellbooks == 0 || sessions.empty()) {
+		std::cout << "Error: nothing to benchmark." << std::endl;
+		release_library(lib);
+		return 1;
+	}
 
-    // allocate dynamic array for all spells
-    spell* all_spells = new spell[total_spells];
+	//only hashes of the passwords are kept, so logins use generate_catalog's pw<i> for wizard 100000 + i. the
+	//first login of a wizard pays the full PBKDF2 cost, later ones hit the login cache
+	std::uint64_t state = 7;
+	int lookups = iterations * 1000;
+	int cold_logins = std::min(lib.num_wizards, iterations * 10);
+	micros.clear();
+	for (int i = 0; i < cold_logins; i++) {
+		const wizard &w = lib.wizards[i];
+		const wizard* user = nullptr;
+		start = std::chrono::steady_clock::now();
+		login_verification(lib.wizards, lib.num_wizards, lib.logins, w.id, "pw" + std::to_string(w.id - 100000), user);
+		micros.push_back(elapsed_us(start));
+	}
+	report_timings("login (uncached)", micros, 0);
 
-    // copy all spells into the array
-    int index = 0;
-    for (int i = 0; i < num_spellbooks; i++) {
-        for (int j = 0; j < spellbooks[i].num_spells; j++) {
-            if (not (is_student && (spellbooks[i].spells[j].effect == "death" || spellbooks[i].spells[j].effect == "poison"))) {
-                all_spells[index++] = spellbooks[i].spells[j];
-            }
-        }
-    }
+	micros.clear();
+	for (int i = 0; i < lookups; i++) {
+		const wizard &w = lib.wizards[next_random(state) % cold_logins];
+		std::string password = "pw" + std::to_string(w.id - 100000);
+		const wizard* user = nullptr;
+		start = std::chrono::steady_clock::now();
+		login_verification(lib.wizards, lib.num_wizards, lib.logins, w.id, password, user);
+		micros.push_back(elapsed_us(start));
+	}
+	report_timings("login (cached)", micros, 0);
 
-    // sort spells in descending order of success rate using bubble sort!!
-    for (int i = 0; i < index - 1; i++) {
-        for (int j = 0; j < index - i - 1; j++) {
-            if (all_spells[j].success_rate < all_spells[j + 1].success_rate) {
-                std::swap(all_spells[j], all_spells[j + 1]);
-            }
-        }
-    }
+	std::ostream discard(nullptr);
+	output_buffer buffer = create_output_buffer(discard);
+	const session &s = sessions.front();
+	for (int prefix = 0; prefix <= 1; prefix++) {
+		micros.clear();
+		buffer.bytes_written = 0;
+		for (int i = 0; i < lookups; i++) {
+			std::string title(pool_view(cat, cat.spellbooks[next_random(state) % cat.num_spellbooks].title));
+			if (prefix)
+				title.pop_back();
+			start = std::chrono::steady_clock::now();
+			write_title_search(buffer, s, title);
+			flush_output(buffer);
+			micros.push_back(elapsed_us(start));
+		}
+		report_timings(prefix ? "title search (prefix)" : "title search", micros, buffer.bytes_written);
+	}
 
-    // print sorted spells
-    for (int i = 0; i < index; i++) {
-        std::cout << all_spells[i].name << " " << all_spells[i].success_rate << " " << all_spells[i].effect << std::endl;
-    }
-	//cleanup
-    delete[] all_spells;  
-}
+	for (int effect = 0; effect < NUM_KNOWN_EFFECTS; effect++) {
+		micros.clear();
+		buffer.bytes_written = 0;
+		for (int i = 0; i < iterations; i++) {
+			start = std::chrono::steady_clock::now();
+			write_effect_search(buffer, s, effect);
+			flush_output(buffer);
+			micros.push_back(elapsed_us(start));
+		}
+		report_timings("effect " + cat.effects.names[effect], micros, buffer.bytes_written);
+	}
+
+	for (const session &ranked : sessions) {
+		std::string role_name = ranked.role == 0 ? "" : std::string(" (") + ROLES[ranked.role].position_title + ")";
+		micros.clear();
+		buffer.bytes_written = 0;
+		for (int i = 0; i < iterations; i++) {
+			start = std::chrono::steady_clock::now();
+			write_ranking(buffer, ranked, 0);
+			flush_output(buffer);
+			micros.push_back(elapsed_us(start));
+		}
+		report_timings("rank all" + role_name, micros, buffer.bytes_written);
+
+		micros.clear();
+		buffer.bytes_written = 0;
+		for (int i = 0; i < iterations; i++) {
+			start = std::chrono::steady_clock::now();
+			write_ranking(buffer, ranked, 10);
+			flush_output(buffer);
+			micros.push_back(elapsed_us(start));
+		}
+		report_timings("rank 10" + role_name, micros, buffer.bytes_written);
+	}
+
+	micros.clear();
+	buffer.bytes_written = 0;
+	for (int i = 0; i < iterations; i++) {
+		start = std::chrono::steady_clock::now();
+		write_all_spellbooks(buffer, s);
+		flush_output(buffer);
+		micros.push_back(elapsed_us(start));
+	}
+	report_timings("display all", micros, buffer.bytes_written);
+
+	std::string export_file = spellbook_file + ".bench_export";
+	micros.clear();
+	std::size_t exported = 0;
+	for (int i = 0; i < std::max(1, iterations / 10); i++) {
+		start = std::chrono::steady_clock::now();
+		std::ofstream outfile(export_file);
+		display_cursor cursor = open_display_cursor(EXPORT_PAGE_SIZE);
+		exported += spellbook_to_file(outfile, s, cursor);
+		outfile.close();
+		micros.push_back(elapsed_us(start));
+	}
+	std::remove(export_file.c_str());
+	report_timings("export", micros, exported);
+
+	//the same export split over one file per thread (and then some, so a slow file doesn't hold the rest up)
+	int num_shards = 4 * std::max(1u, std::thread::hardware_concurrency());
+	std::string shard_prefix = spellbook_file + ".bench_shard_";
+	micros.clear();
+	exported = 0;
+	for (int i = 0; i < std::max(1, iterations / 10); i++) {
+		int num_files = 0;
+		std::string error;
+		start = std::chrono::steady_clock::now();
+		exported += export_shards(s, shard_prefix, SHARD_BY_HASH, num_shards, num_files, error);
+		micros.push_back(elapsed_us(start));
+	}
+	for (int t = 0; t < num_shards; t++)
+		std::remove((shard_prefix + std::to_string(t) + ".txt").c_str());
+	report_timings("export (sharded)", micros, exported);
 
+	sessions.clear();
+	release_library(lib);
+	return 0;
+}
 
 /*
 Function: main_menu
 Description: gives main menu options to user and using their input, lets them do various things as outlined in the interface 
 	for the main menu. 
-Parameters: spellbook* spellbooks: pointer to spellbook dynamic array
-			int num_spellbooks: number of spellbooks as outlined by user given file
+Parameters: const library &lib: the loaded spellbooks, spells and indexes
 			const wizard& current_user: reference to the current logged in wiazrd object
+			int page_size: spellbooks per page of 'display all', 0 to show them all at once
 */
-void main_menu(spellbook* spellbooks, int num_spellbooks, const wizard& current_user) {
-    bool is_student = (current_user.position_title == "Student");
+void main_menu(const library &lib, const wizard& current_user, int page_size) {
+    //work out what the wizard may see once per session
+    session s;
+    start_session(lib, current_user, s);
     int choice;
     
     do {
@@ -492,12 +5809,12 @@ void main_menu(spellbook* spellbooks, int num_spellbooks, const wizard& current_
         std::cout << "Your Choice: ";
         std::cin >> choice;
         
+        //pick up spellbooks reloaded since the last choice
+        refresh_session(lib, s);
         switch (choice) {
             case 1: { 
-                //display all 
-                for (int i = 0; i < num_spellbooks; i++) {
-                    display_spellbook_info(spellbooks[i], is_student);
-                }
+                //display all, a page at a time if asked for
+                display_selection_all(s, page_size);
                 break;
             }
             case 2: { 
@@ -506,32 +5823,24 @@ void main_menu(spellbook* spellbooks, int num_spellbooks, const wizard& current_
                 std::cout << "Enter spellbook name: ";
                 std::cin >> book_name;
                 
-				//iterate through spellbooks and print the info to the terminal
-                bool found = false;
-                for (int i = 0; i < num_spellbooks; i++) {
-                    if (spellbooks[i].title == book_name) {
-                        display_spellbook_info(spellbooks[i], is_student);
-                        found = true;
-                        break;
-                    }
-                }
-                //error handling for incorrect user input
-				if (not found) {
-					std::cout << "No spellbook found with that name." << std::endl;
-                }
+				//look the title up and print the info to the terminal
+                output_buffer buffer = create_output_buffer(std::cout);
+                write_title_search(buffer, s, book_name);
+                flush_output(buffer);
                 break;
             }
             case 3: {
                 //search by effect
-                std::string effect;
+                std::string effect_name;
+                int effect;
                 bool valid_effect;
                 do {
                     std::cout << "Enter the spell effect: ";
-                    std::cin >> effect;
+                    std::cin >> effect_name;
+                    effect = find_string(s.version->cat.effects, effect_name);
                     
 					//making sure students can't access 'death' and 'poison')
-                    valid_effect = effect == "fire" || effect == "bubble" || effect == "memory_loss" || effect == "healing" ||
-                                 (not is_student && (effect == "death" || effect == "poison"));
+                    valid_effect = effect_allowed(s, effect);
                     
                     if (not valid_effect) {
                         std::cout << "Error: Invalid spell effect" << std::endl;
@@ -539,13 +5848,13 @@ void main_menu(spellbook* spellbooks, int num_spellbooks, const wizard& current_
                 } while (not valid_effect);
                 
 				//print spell info to terminal OR append to file
-                display_selection_effect(spellbooks, num_spellbooks, effect, is_student);
+                display_selection_effect(s, effect);
                 break;
             }
             case 4: {
 				//sort by average success rate !!
 				//print spell info to terminal OR append to file
-                display_selection_avg_success(spellbooks, num_spellbooks, is_student);
+                display_selection_avg_success(s);
                 break;
             }
             case 5: {
@@ -564,54 +5873,169 @@ void main_menu(spellbook* spellbooks, int num_spellbooks, const wizard& current_
 Function: main
 Description: main function for program, reads in data, does error handling for file mishaps, and
 	passes info the various functions for the login and main menu processes
-Parameters: none
+Parameters: int argc, char* argv[]: command line. 
+				"--save-snapshot <file>" saves the loaded spellbooks as a binary snapshot, which can then
+					be given instead of the spellbook file next time
+				"--batch <wizard file> <spellbook file> <query file>" runs a query script (see run_query)
+					instead of the interactive login and menu, "-" reads the script from std::cin
+				"--serve <wizard file> <spellbook file> <socket path>" runs the query server (see run_server)
+				"--workers <n>" sets the size of the query server's worker pool
+				"--watch" reloads the spellbook file whenever it changes (see watch_spellbooks)
+				"--generate <wizard file> <spellbook file> <spellbooks> <spells per book>" writes a synthetic
+					catalog (see generate_catalog)
+				"--stream <wizard file> <spellbook file> <query file>" runs a query script with every query
+					reading the spellbook file once instead of loading it (see run_stream_query)
+				"--bench <wizard file> <spellbook file>" times loading and querying the files (see run_bench)
+				"--iterations <n>" sets how many times the benchmark repeats its slower operations
+				"--page-size <n>" makes the menu's 'display all' show n spellbooks at a time (see
+					display_selection_all)
+				"--hash-wizards <wizard file> <hashed file>" writes a copy of a wizard file with hashed
+					passwords (see hash_wizard_file)
+				"--stats <text|json>" turns on the instrumentation and prints what it recorded on exit (see
+					write_stats), the query command "stats [json]" prints it on demand
 */
-int main () {
+int main (int argc, char* argv[]) {
 	
 	//initialize all the needed variables
 	std::string wizard_file;
 	std::string spellbook_file;
-	std::ifstream wizard_in;
-	std::ifstream spellbook_in;
-	wizard* wizards = nullptr;
-	spellbook* spellbooks = nullptr;
-	int num_wizards = 0; 
-	int num_spellbooks = 0;
-	wizard current_user;
+	std::string query_file;
+	std::string snapshot_file;
+	std::string socket_path;
+	int num_workers = std::max(1u, std::thread::hardware_concurrency());
+	int num_generated = -1;
+	int spells_per_book = 0;
+	bool bench = false;
+	bool streaming = false;
+	int iterations = 20;
+	int page_size = 0;
+	std::string stats_format;
+	std::string hashed_wizard_file;
+	library lib = {};
+	const wizard* current_user = nullptr;
+	file_watch watch;
+	watch.stopping = false;
+	std::thread watcher;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--save-snapshot" && i + 1 < argc) {
+			snapshot_file = argv[++i];
+		} else if (arg == "--batch" && i + 3 < argc) {
+			wizard_file = argv[++i];
+			spellbook_file = argv[++i];
+			query_file = argv[++i];
+		} else if (arg == "--serve" && i + 3 < argc) {
+			wizard_file = argv[++i];
+			spellbook_file = argv[++i];
+			socket_path = argv[++i];
+		} else if (arg == "--workers" && i + 1 < argc) {
+			num_workers = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--watch") {
+			lib.watching = true;
+		} else if (arg == "--generate" && i + 4 < argc) {
+			wizard_file = argv[++i];
+			spellbook_file = argv[++i];
+			num_generated = std::max(0, std::atoi(argv[++i]));
+			spells_per_book = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--stream" && i + 3 < argc) {
+			wizard_file = argv[++i];
+			spellbook_file = argv[++i];
+			query_file = argv[++i];
+			streaming = true;
+		} else if (arg == "--bench" && i + 2 < argc) {
+			wizard_file = argv[++i];
+			spellbook_file = argv[++i];
+			bench = true;
+		} else if (arg == "--stats" && i + 1 < argc && (std::string(argv[i + 1]) == "text" || std::string(argv[i + 1]) == "json")) {
+			stats_format = argv[++i];
+			stats_enabled = true;
+		} else if (arg == "--hash-wizards" && i + 2 < argc) {
+			wizard_file = argv[++i];
+			hashed_wizard_file = argv[++i];
+		} else if (arg == "--page-size" && i + 1 < argc) {
+			page_size = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--iterations" && i + 1 < argc) {
+			iterations = std::max(1, std::atoi(argv[++i]));
+		} else {
+			std::cout << "Error: unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	//the benchmarking tools load (or write) their own files
+	if (lib.watching && (num_generated >= 0 || not hashed_wizard_file.empty() || bench || streaming)) {
+		std::cout << "Error: --watch only works with the menu, --batch and --serve." << std::endl;
+		return 1;
+	}
+	if (num_generated >= 0)
+		return generate_catalog(wizard_file, spellbook_file, num_generated, spells_per_book) ? 0 : 1;
+	if (not hashed_wizard_file.empty())
+		return hash_wizard_file(wizard_file, hashed_wizard_file) ? 0 : 1;
+	if (bench) {
+		int status = run_bench(wizard_file, spellbook_file, iterations);
+		print_stats(stats_format);
+		return status;
+	}
+
+	if (streaming) {
+		int status = run_stream(wizard_file, spellbook_file, query_file);
+		print_stats(stats_format);
+		return status;
+	}
+
+	bool interactive = query_file.empty() && socket_path.empty();
 
 	//error handling for file accessing
-	if (not input_files(wizard_file, spellbook_file)) {
+	if (interactive && not input_files(wizard_file, spellbook_file)) {
 		std::cout << "Error: file names incorrect or missing." << std::endl;
 		return 0;
 	}
-	if (not open_files(wizard_file, spellbook_file, wizard_in, spellbook_in)) {
-		return 0;
-	}
 
 	//error handling for reading in the data
-	if (not read_in_data(wizard_in, spellbook_in, wizards, spellbooks, num_wizards, num_spellbooks)) {
-		delete_wizards(wizards);
-		delete_spellbooks(spellbooks, num_spellbooks);
-		wizard_in.close();
-		spellbook_in.close();
-		return 0;
+	if (not load_library(wizard_file, spellbook_file, lib)) {
+		release_library(lib);
+		return interactive ? 0 : 1;
+	}
+
+	//save the spellbooks for a fast restart if asked to
+	if (not snapshot_file.empty()) {
+		if (write_snapshot(*lib.spellbooks, snapshot_file))
+			std::cout << "Saved snapshot to " << snapshot_file << std::endl;
+		else
+			std::cout << "Error: could not write snapshot " << snapshot_file << std::endl;
+	}
+
+	//keep the spellbooks up to date with the file in the background if asked to. the query server starts
+	//its own watcher once it has blocked the shutdown signals
+	if (lib.watching && socket_path.empty())
+		watcher = std::thread(watch_spellbooks, std::ref(lib), std::ref(watch));
+
+	//scripted queries or the query server instead of the interactive session
+	if (not interactive) {
+		int status = query_file.empty() ? run_server(lib, socket_path, num_workers, watch, watcher) :
+			run_batch(lib, query_file);
+		stop_watching(watch, watcher);
+		print_stats(stats_format);
+		release_library(lib);
+		return status;
 	}
-	wizard_in.close();
-	spellbook_in.close();
 
 	//error handling for logging in
-	if (not user_login(wizards, num_wizards, current_user)) {
-		delete_wizards(wizards);
-		delete_spellbooks(spellbooks, num_spellbooks);
+	if (not user_login(lib.wizards, lib.num_wizards, lib.logins, current_user)) {
+		stop_watching(watch, watcher);
+		print_stats(stats_format);
+		release_library(lib);
 		return 0;
 	}
 
 	//run the actual user-selection part of the program
-	main_menu(spellbooks, num_spellbooks, current_user);
+	main_menu(lib, *current_user, page_size);
 
 	//cleaning up after the user decides to exit
-	delete_wizards(wizards);
-	delete_spellbooks(spellbooks, num_spellbooks);
+	stop_watching(watch, watcher);
+	print_stats(stats_format);
+	release_library(lib);
 
 	return 0;
 